@@ -2,173 +2,117 @@
 #include "Scheduler.hpp"
 #include "Task.hpp"
 
-#include <atomic>
+#include <iostream>
+#include <memory>
 #include <mutex>
-#include <thread>
+#include <stdexcept>
+#include <utility>
 
 #include <CL/cl.h>
 
-#include "util/queue/queue.hpp"
-#include <memory>
-#include <stdexcept>
-#include <vector>
+#include "device/cost_model.hpp"
+#include "device/device.hpp"
+#include "device/device_impl.hpp"
 
 namespace {
 static unsigned int count_ref{0};
 
 static std::mutex ctor_dtor_lock;
 
-static std::thread scheduler_thread;
-
-static opencle::queue<opencle::Task> task_queue;
-
-void notify(const char *, const void *, size_t, void *) {
-    throw std::runtime_error{"OpenCL runtime error"};
+static std::unique_ptr<opencle::scheduler> task_scheduler;
+
+opencle::device_type get_device_type(opencle::Device_Type type) {
+    switch (type) {
+    case opencle::Device_Type::ACC:
+        return opencle::device_type::ACCELERATOR;
+    case opencle::Device_Type::ALL:
+        return opencle::device_type::ALL;
+    case opencle::Device_Type::CPU:
+        return opencle::device_type::CPU;
+    case opencle::Device_Type::GPU:
+        return opencle::device_type::GPU;
+    default:
+        return opencle::device_type::DEFAULT;
+    }
 }
 
 } // namespace
 
 namespace opencle {
 
-AMP::AMP(Device_Type type) {
-    ctor_dtor_lock.lock();
-
-    static std::vector<Device> processor_list{};
+AMP::AMP(Device_Type type, scheduler_option const &option) {
+    std::lock_guard<std::mutex> lock{ctor_dtor_lock};
 
     if (count_ref == 0) {
-        cl_int status{0};
-
-        // Initialize opencl platforms
-        cl_uint platform_num{0};
-
-        status = clGetPlatformIDs(0, NULL, &platform_num);
-
-        if (status != CL_SUCCESS) {
-            throw std::runtime_error{"OpenCL initialization error."};
-        }
-        if (platform_num == 0) {
-            throw std::runtime_error{"No OpenCL platform available."};
-        }
-
-        std::unique_ptr<cl_platform_id[]> platforms{
-            new cl_platform_id[platform_num]};
-        status = clGetPlatformIDs(platform_num, platforms.get(), NULL);
-
-        if (status != CL_SUCCESS) {
-            throw std::runtime_error{"OpenCL initialization error."};
-        }
-
-        // Initialize opencl devices
-        cl_device_type device_type{CL_DEVICE_TYPE_DEFAULT};
-        switch (type) {
-        case Device_Type::ACC:
-            device_type = CL_DEVICE_TYPE_ACCELERATOR;
-            break;
-        case Device_Type::ALL:
-            device_type = CL_DEVICE_TYPE_ALL;
-            break;
-        case Device_Type::CPU:
-            device_type = CL_DEVICE_TYPE_CPU;
-            break;
-        case Device_Type::GPU:
-            device_type = CL_DEVICE_TYPE_GPU;
-            break;
-        default:
-            device_type = CL_DEVICE_TYPE_DEFAULT;
-            break;
+        // discovery is shared with device::create_device_list, a list
+        // created before, with any type and option, is kept
+        if (!device::is_device_list_created()) {
+            device::create_device_list(get_device_type(type));
         }
 
-        for (int i = 0; i < platform_num; ++i) {
-            cl_uint device_num{0};
-            status = clGetDeviceIDs(platforms.get()[i], device_type, 0, NULL,
-                                    &device_num);
-
-            if (status != CL_SUCCESS) {
-                throw std::runtime_error{"OpenCL initialization error."};
-            }
-            if (device_num == 0) {
-                throw std::runtime_error{"No OpenCL device available."};
-            }
-
-            std::unique_ptr<cl_device_id[]> devices{
-                new cl_device_id[device_num]};
-            status = clGetDeviceIDs(platforms.get()[i], device_type, device_num,
-                                    devices.get(), NULL);
-
-            for (int j = 0; j < device_num; ++j) {
-                processor_list.push_back({devices.get()[j], NULL, NULL});
-            }
-
-            devices.release();
-        }
-        platforms.release();
-
-        // Initialize context
-
-        for (auto &processor : processor_list) {
-            processor.context = clCreateContext(NULL, 1, &processor.device,
-                                                notify, NULL, &status);
-            if (status != CL_SUCCESS) {
-                throw std::runtime_error{"OpenCL initialization error."};
-            }
-        }
-
-        // Initialize opencl command queues.
-
-        for (auto &processor : processor_list) {
-            // Property may be change.
-            processor.c_queue = clCreateCommandQueue(
-                processor.context, processor.device, 0, &status);
-            if (status != CL_SUCCESS) {
-                throw std::runtime_error{"OpenCL initialization error."};
-            }
-        }
-
-        // Initialize scheduler thread
-        std::thread scheduler{schedule, std::ref(processor_list),
-                              std::ref(task_queue)};
-        scheduler_thread = std::move(scheduler);
+        // one worker per device, the list must not be sorted meanwhile
+        task_scheduler = std::make_unique<scheduler>(device::get_device_list(),
+                                                     option);
     }
 
     ++count_ref;
-    ctor_dtor_lock.unlock();
 }
 
-AMP::AMP(AMP const &rhs) {}
+AMP::AMP(AMP const &) {
+    std::lock_guard<std::mutex> lock{ctor_dtor_lock};
+    ++count_ref;
+}
 
-AMP::AMP(AMP &&rhs) {}
+AMP::AMP(AMP &&) {
+    std::lock_guard<std::mutex> lock{ctor_dtor_lock};
+    ++count_ref;
+}
 
 AMP::~AMP() {
-    ctor_dtor_lock.lock();
+    std::lock_guard<std::mutex> lock{ctor_dtor_lock};
 
     --count_ref;
 
     if (count_ref == 0) {
-        // push end-of-task Task
+        // runs the tasks still queued, then joins the threads
+        task_scheduler.reset();
 
-        // destruct scheduler_thread
-        scheduler_thread.join();
-
-        // destruct task queue
-        task_queue.~queue();
+        // the next run places its first tasks with what this one learned
+        cost_model::save();
     }
-    ctor_dtor_lock.unlock();
 }
 
-AMP &AMP::operator=(AMP const &rhs) { return *this; }
+AMP &AMP::operator=(AMP const &) { return *this; }
 
-AMP &AMP::operator=(AMP &&rhs) { return *this; }
+AMP &AMP::operator=(AMP &&) { return *this; }
 
-} // namespace opencle
+void AMP::exec(Task const &rhs, Callback call_back) {
+    task_scheduler->submit(rhs, std::move(call_back));
+}
+
+void AMP::exec(Task &&rhs, Callback call_back) {
+    task_scheduler->submit(std::move(rhs), std::move(call_back));
+}
 
-#if 0
+bool AMP::try_exec(Task const &rhs, Callback call_back) {
+    Task task{rhs};
+    return task_scheduler->try_submit(std::move(task), std::move(call_back));
+}
 
-    Scheduler &operator=(Scheduler const &rhs);
-    Scheduler &operator=(Scheduler &&rhs);
-    Scheduler &operator[](size_t num);
+bool AMP::try_exec(Task &&rhs, Callback call_back) {
+    return task_scheduler->try_submit(std::move(rhs), std::move(call_back));
+}
 
-    Memories exec(Task const &rhs, std::function<void(const Memories&)> func);
-    Memories exec(Task &&rhs, std::function<void(const Memories&)> func);
+void AMP::print_info() {
+    for (auto const &dev : device::get_device_list()) {
+        device_impl const &impl = *dev.get_device_impl();
+        std::cout << impl.get_identifier() << (impl ? "" : " (failed)")
+                  << ": queue depth " << impl.get_queue_depth()
+                  << ", expected time " << impl.get_expected_time() << " s"
+                  << std::endl;
+    }
+    std::cout << task_scheduler->get_pending_num() << " tasks pending, "
+              << task_scheduler->get_pending_bytes() << " bytes" << std::endl;
+}
 
-    void print_info();
-#endif
+} // namespace opencle
@@ -1,32 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
 #include <functional>
-#include <vector>
+
+#include "scheduler_option.hpp"
 
 namespace opencle {
 
 enum class Device_Type { ACC, ALL, CPU, GPU, DEF };
 
-class Memory;
 class Task;
 
 /**An RAII and Single object, used for manage all OpenCL
  * devices, and assign tasks for OpenCL devices */
 class AMP final {
-    using Memories = std::vector<Memory>;
-
   public:
+    using Callback = std::function<void(std::exception_ptr)>;
+
     /** If ref_count = 0, initialize OpenCL devices based
-     * on 'type', initialize task queue, and set ref_count
-     * to be 1; if ref_count > 0, then increase ref_count. */
-    AMP(Device_Type type = Device_Type::ALL);
+     * on 'type', start the scheduler with 'option', and set
+     * ref_count to be 1; if ref_count > 0, then increase
+     * ref_count and ignore 'option'. */
+    AMP(Device_Type type = Device_Type::ALL,
+        scheduler_option const &option = scheduler_option{});
 
-    /** Do nothing */
+    /** Increase ref_count */
     AMP(AMP const &rhs);
 
-    /** Do nothing */
+    /** Increase ref_count */
     AMP(AMP &&rhs);
 
-    /** Decrease ref_count, and check if ref_count = 0, release
-     * all resources */
+    /** Decrease ref_count, and check if ref_count = 0, run
+     * the submitted tasks and release all resources */
     ~AMP();
 
     /** Do nothing */
@@ -35,14 +41,21 @@ class AMP final {
     /** Do nothing */
     AMP &operator=(AMP &&rhs);
 
-    /** Push task into task queue, and let Scheduler decide how to
-     * assgin the task, when the task in finished, call the 'call_back'*/
-    Memories exec(Task const &rhs,
-                  std::function<void(const Memories &)> call_back);
-    Memories exec(Task &&rhs, std::function<void(const Memories &)> call_back);
+    /** Push task into task queue and return, the scheduler
+     * decides which device runs it; when the task is finished,
+     * call the 'call_back' with the exception it threw, or
+     * nullptr. At a limit of scheduler_option, wait or
+     * throw according to scheduler_option::policy */
+    void exec(Task const &rhs, Callback call_back);
+    void exec(Task &&rhs, Callback call_back);
+
+    /** Like exec, but never wait: return false when the
+     * task cannot be admitted now, and leave 'rhs' as is */
+    bool try_exec(Task const &rhs, Callback call_back);
+    bool try_exec(Task &&rhs, Callback call_back);
 
     /** print all necessary infomation */
     void print_info();
 };
 
-} // namespace opencle
\ No newline at end of file
+} // namespace opencle
@@ -0,0 +1,490 @@
+#include "Scheduler.hpp"
+
+#include <algorithm>
+#include <random>
+#include <stdexcept>
+
+#include "device/device.hpp"
+#include "device/device_impl.hpp"
+#include "memory/global_ptr_impl.hpp"
+#include "util/logger/logger.hpp"
+#include "util/metrics/metrics.hpp"
+#include "util/trace/trace.hpp"
+
+namespace {
+
+size_t __get_random_index(size_t num) {
+    thread_local std::minstd_rand engine{std::random_device{}()};
+    return std::uniform_int_distribution<size_t>{0, num - 1}(engine);
+}
+
+cl_device_type __get_device_type(opencle::device const &dev) {
+    cl_device_type type = 0;
+    clGetDeviceInfo(dev.get_device_impl()->get_device_id(), CL_DEVICE_TYPE,
+                    sizeof(cl_device_type), &type, NULL);
+    return type;
+}
+
+cl_device_type __get_required_type(opencle::device_type type) {
+    switch (type) {
+    case opencle::device_type::CPU:
+        return CL_DEVICE_TYPE_CPU;
+    case opencle::device_type::GPU:
+        return CL_DEVICE_TYPE_GPU;
+    case opencle::device_type::ACCELERATOR:
+        return CL_DEVICE_TYPE_ACCELERATOR;
+    default:
+        return 0;
+    }
+}
+
+} // namespace
+
+namespace opencle {
+
+constexpr std::chrono::milliseconds scheduler::idle_poll_interval;
+constexpr size_t scheduler::max_steal_scan_num;
+constexpr size_t scheduler::submit_capacity;
+constexpr size_t scheduler::dispatch_batch_num;
+
+scheduler::scheduler(std::vector<device> const &devices,
+                     scheduler_option const &option)
+    : option_{option}, next_sequence_{0}, submitted_{submit_capacity},
+      stopping_{false}, pending_num_{0}, pending_bytes_{0},
+      dispatcher_done_{false} {
+    logger("scheduler(std::vector<device> const &, scheduler_option const &), create "
+           << this);
+    for (auto const &dev : devices) {
+        auto w = std::make_unique<worker>();
+        w->dev = &dev;
+        w->type = __get_device_type(dev);
+        workers_.push_back(std::move(w));
+    }
+
+    // thieves look at every worker, so all of them exist before any runs
+    for (auto &w : workers_) {
+        worker *target = w.get();
+        w->threads.emplace_back([this, target] { work(*target, false); });
+        for (size_t i = 0; i < option_.reserved_num; ++i) {
+            w->threads.emplace_back([this, target] { work(*target, true); });
+        }
+    }
+    dispatcher_ = std::thread{[this] { dispatch(); }};
+}
+
+scheduler::~scheduler() {
+    logger("~scheduler(), destory " << this);
+    stopping_ = true;
+    {
+        std::lock_guard<std::mutex> lock{room_mutex_};
+    }
+    room_cv_.notify_all();
+
+    // tasks of a failed device come back through the queue, so it is only
+    // closed once everything has run
+    {
+        std::unique_lock<std::mutex> lock{drain_mutex_};
+        drained_cv_.wait(lock, [this] { return pending_num_ == 0; });
+    }
+    item stop;
+    stop.is_stop = true;
+    submitted_.push(std::move(stop));
+    dispatcher_.join();
+    for (auto &w : workers_) {
+        for (auto &thread : w->threads) {
+            thread.join();
+        }
+    }
+}
+
+double scheduler::get_completion_time(Task const &task, device_impl const *dev) {
+    double transfer_time = 0;
+    for (global_ptr_impl const *input : task.get_inputs()) {
+        transfer_time += input->get_transfer_time(dev);
+    }
+    return dev->get_completion_time(task.get_kernel_name(), task.get_work_items(),
+                                    transfer_time);
+}
+
+double scheduler::get_rank(Task const &task) const {
+    double total = 0;
+    size_t num = 0;
+    for (auto const &w : workers_) {
+        device_impl const &impl = *w->dev->get_device_impl();
+        if (is_compatible(task, w->type) && impl) {
+            total += impl.get_runtime(task.get_kernel_name(), task.get_work_items());
+            ++num;
+        }
+    }
+    return num > 0 ? total / num : 0;
+}
+
+size_t scheduler::get_class_num(bool is_reserved) {
+    return is_reserved ? 1 : task_priority_num;
+}
+
+bool scheduler::is_compatible(Task const &task, cl_device_type type) {
+    cl_device_type required = __get_required_type(task.get_device_type());
+    return required == 0 || (type & required);
+}
+
+size_t scheduler::get_footprint(Task const &task) {
+    size_t bytes = 0;
+    for (global_ptr_impl const *input : task.get_inputs()) {
+        bytes += input->size();
+    }
+    return bytes;
+}
+
+bool scheduler::try_admit(size_t bytes) {
+    size_t num = pending_num_.load();
+    do {
+        if (option_.max_pending_num > 0 && num >= option_.max_pending_num) {
+            return false;
+        }
+    } while (!pending_num_.compare_exchange_weak(num, num + 1));
+
+    // a task over the limit on its own still runs when nothing else does
+    size_t total = pending_bytes_.fetch_add(bytes) + bytes;
+    if (option_.max_pending_bytes > 0 && total > option_.max_pending_bytes &&
+        total != bytes) {
+        release(bytes);
+        return false;
+    }
+    return true;
+}
+
+void scheduler::release(size_t bytes) {
+    pending_bytes_ -= bytes;
+    if (--pending_num_ == 0) {
+        std::lock_guard<std::mutex> lock{drain_mutex_};
+        drained_cv_.notify_all();
+    }
+}
+
+void scheduler::submit(Task task, Callback call_back) {
+    logger("submit(Task, Callback)");
+    static counter &tasks =
+        metrics::get_counter("opencle_amp_tasks_total", "Tasks submitted through AMP");
+    static counter &rejects = metrics::get_counter(
+        "opencle_amp_rejected_total", "Tasks not admitted at a limit of the scheduler");
+    if (stopping_) {
+        throw std::runtime_error{"Submit a task to a stopped scheduler"};
+    }
+
+    size_t bytes = get_footprint(task);
+    if (!try_admit(bytes)) {
+        if (option_.policy == admission_policy::REJECT) {
+            rejects.add();
+            throw std::runtime_error{"Too many tasks pending, the task is not admitted"};
+        }
+        bool is_admitted = false;
+        std::unique_lock<std::mutex> lock{room_mutex_};
+        room_cv_.wait(lock, [this, bytes, &is_admitted] {
+            return stopping_ || (is_admitted = try_admit(bytes));
+        });
+        if (!is_admitted) {
+            throw std::runtime_error{"Submit a task to a stopped scheduler"};
+        }
+    }
+
+    item it{std::move(task), std::move(call_back)};
+    it.sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+    it.bytes = bytes;
+    submitted_.push(std::move(it));
+    tasks.add();
+}
+
+bool scheduler::try_submit(Task &&task, Callback &&call_back) {
+    logger("try_submit(Task &&, Callback &&)");
+    static counter &tasks =
+        metrics::get_counter("opencle_amp_tasks_total", "Tasks submitted through AMP");
+    static counter &rejects = metrics::get_counter(
+        "opencle_amp_rejected_total", "Tasks not admitted at a limit of the scheduler");
+    if (stopping_) {
+        throw std::runtime_error{"Submit a task to a stopped scheduler"};
+    }
+
+    size_t bytes = get_footprint(task);
+    if (!try_admit(bytes)) {
+        rejects.add();
+        return false;
+    }
+
+    item it{std::move(task), std::move(call_back)};
+    it.sequence = next_sequence_.fetch_add(1, std::memory_order_relaxed);
+    it.bytes = bytes;
+    if (!submitted_.try_push(std::move(it))) {
+        // the placing thread is behind, give the task back
+        task = std::move(it.task);
+        call_back = std::move(it.call_back);
+        release(bytes);
+        rejects.add();
+        return false;
+    }
+    tasks.add();
+    return true;
+}
+
+size_t scheduler::get_pending_num() const { return pending_num_; }
+
+size_t scheduler::get_pending_bytes() const { return pending_bytes_; }
+
+void scheduler::dispatch() {
+    logger("dispatch()");
+    std::vector<std::pair<double, item>> batch;
+    bool is_stopped = false;
+    while (!is_stopped) {
+        item it;
+        submitted_.pop(it);
+        do {
+            if (it.is_stop) {
+                is_stopped = true;
+                break;
+            }
+            double rank = get_rank(it.task);
+            batch.emplace_back(rank, std::move(it));
+        } while (batch.size() < dispatch_batch_num && submitted_.try_pop(it));
+
+        // higher classes first, then the longest tasks while every device
+        // still has room for them
+        std::stable_sort(batch.begin(), batch.end(), [](auto const &lhs, auto const &rhs) {
+            if (lhs.second.task.get_priority() != rhs.second.task.get_priority()) {
+                return lhs.second.task.get_priority() < rhs.second.task.get_priority();
+            }
+            return lhs.first > rhs.first;
+        });
+        for (auto &entry : batch) {
+            place(std::move(entry.second));
+        }
+        batch.clear();
+    }
+
+    dispatcher_done_ = true;
+    for (auto &w : workers_) {
+        {
+            std::lock_guard<std::mutex> lock{w->mutex};
+        }
+        w->general_cv.notify_all();
+        w->reserved_cv.notify_all();
+    }
+}
+
+void scheduler::place(item &&it) {
+    logger("place(item &&)");
+    std::vector<worker *> candidates;
+    for (auto &w : workers_) {
+        if (is_compatible(it.task, w->type) && *w->dev->get_device_impl()) {
+            candidates.push_back(w.get());
+        }
+    }
+    if (candidates.empty()) {
+        finish(it, std::make_exception_ptr(std::runtime_error{
+                       "No healthy device of the type the task needs"}));
+        return;
+    }
+
+    // every candidate is costed, the inputs may sit on any of them
+    worker *best = nullptr;
+    double best_time = 0;
+    for (worker *w : candidates) {
+        double time = get_completion_time(it.task, w->dev->get_device_impl().get());
+        if (!best || time < best_time) {
+            best = w;
+            best_time = time;
+        }
+    }
+    best->dev->get_device_impl()->selection_increment();
+    push(*best, std::move(it));
+}
+
+void scheduler::push(worker &w, item &&it) {
+    it.counted_on = w.dev->get_device_impl().get();
+    it.cost = it.counted_on->get_runtime(it.task.get_kernel_name(), it.task.get_work_items());
+    it.counted_on->queue_depth_increment(1);
+    it.counted_on->backlog_increment(it.cost);
+    bool is_high = it.task.get_priority() == task_priority::HIGH;
+    {
+        std::lock_guard<std::mutex> lock{w.mutex};
+        size_t c = static_cast<size_t>(it.task.get_priority());
+        ready_key key{it.task.get_deadline(), it.sequence};
+        w.items[c].emplace(key, std::move(it));
+        ++w.queued_nums[c];
+    }
+    // a busy thread pops the task itself once it is done
+    w.general_cv.notify_one();
+    if (is_high) {
+        w.reserved_cv.notify_one();
+    }
+}
+
+bool scheduler::pop(worker &w, item &it, bool is_reserved) {
+    std::lock_guard<std::mutex> lock{w.mutex};
+    for (size_t c = 0; c < get_class_num(is_reserved); ++c) {
+        if (!w.items[c].empty()) {
+            it = std::move(w.items[c].begin()->second);
+            w.items[c].erase(w.items[c].begin());
+            --w.queued_nums[c];
+            return true;
+        }
+    }
+    return false;
+}
+
+bool scheduler::steal(worker &w, item &it, bool is_reserved) {
+    static counter &steals = metrics::get_counter(
+        "opencle_amp_steals_total", "Tasks taken from the queue of another device");
+    device_impl const *thief = w.dev->get_device_impl().get();
+
+    // start at a random victim, so thieves do not all drain the same one
+    size_t num = workers_.size();
+    size_t start = __get_random_index(num);
+    for (size_t i = 0; i < num; ++i) {
+        worker &victim = *workers_[(start + i) % num];
+        bool is_empty = true;
+        for (size_t c = 0; c < get_class_num(is_reserved); ++c) {
+            is_empty = is_empty && victim.queued_nums[c] == 0;
+        }
+        if (&victim == &w || is_empty) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock{victim.mutex};
+        device_impl const *owner = victim.dev->get_device_impl().get();
+        // the most urgent task that gains from moving, among the first few
+        // of each class so a long queue does not hold the lock long
+        for (size_t c = 0; c < get_class_num(is_reserved); ++c) {
+            size_t scan_num = 0;
+            for (auto entry = victim.items[c].begin();
+                 entry != victim.items[c].end() && scan_num < max_steal_scan_num;
+                 ++entry, ++scan_num) {
+                Task const &task = entry->second.task;
+                if (!is_compatible(task, w.type)) {
+                    continue;
+                }
+                // a slower device, or one the inputs would have to move to,
+                // would only delay the task
+                if (*owner && get_completion_time(task, owner) <= get_completion_time(task, thief)) {
+                    continue;
+                }
+                it = std::move(entry->second);
+                victim.items[c].erase(entry);
+                --victim.queued_nums[c];
+                steals.add();
+                logger("Steal a task of device " << *owner << " for device " << *thief);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool scheduler::has_queued(worker &w, bool is_reserved) {
+    for (size_t c = 0; c < get_class_num(is_reserved); ++c) {
+        if (!w.items[c].empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void scheduler::run(worker &w, item &it) {
+    logger("run(worker &, item &)");
+    it.counted_on->queue_depth_increment(-1);
+    it.counted_on->backlog_increment(-it.cost);
+
+    static counter &misses = metrics::get_counter(
+        "opencle_amp_deadline_misses_total", "Tasks finished after their deadline");
+
+    std::exception_ptr error = nullptr;
+    {
+        trace_span span{"task", "amp", w.dev->get_device_impl().get()};
+        try {
+            it.task(*w.dev);
+        } catch (...) {
+            error = std::current_exception();
+        }
+    }
+    if (std::chrono::steady_clock::now() > it.task.get_deadline()) {
+        misses.add();
+    }
+    finish(it, error);
+}
+
+void scheduler::hand_back(worker &w) {
+    logger("hand_back(worker &)");
+    std::array<ready_queue, task_priority_num> items;
+    {
+        std::lock_guard<std::mutex> lock{w.mutex};
+        items.swap(w.items);
+        for (auto &queued_num : w.queued_nums) {
+            queued_num = 0;
+        }
+    }
+
+    size_t num = 0;
+    for (auto const &ready : items) {
+        num += ready.size();
+    }
+    if (num == 0) {
+        return;
+    }
+
+    logger_warn("Device " << *w.dev->get_device_impl() << " failed, place its "
+                          << num << " tasks again");
+    // most urgent first, they are placed in this order
+    for (auto &ready : items) {
+        for (auto &entry : ready) {
+            entry.second.counted_on->queue_depth_increment(-1);
+            entry.second.counted_on->backlog_increment(-entry.second.cost);
+            submitted_.push(std::move(entry.second));
+        }
+    }
+}
+
+void scheduler::work(worker &w, bool is_reserved) {
+    logger("work(worker &, bool)");
+    device_impl const &impl = *w.dev->get_device_impl();
+    while (true) {
+        item it;
+        // stealing locks other workers, it never runs under w.mutex
+        if (impl && (pop(w, it, is_reserved) || steal(w, it, is_reserved))) {
+            run(w, it);
+            continue;
+        }
+        if (!impl) {
+            hand_back(w);
+        }
+
+        // the device may fail while idle and other queues fill up without
+        // waking this thread, so the wait is bounded
+        std::unique_lock<std::mutex> lock{w.mutex};
+        if (dispatcher_done_) {
+            break;
+        }
+        std::condition_variable &cv = is_reserved ? w.reserved_cv : w.general_cv;
+        cv.wait_for(lock, idle_poll_interval, [this, &w, is_reserved] {
+            return dispatcher_done_ || has_queued(w, is_reserved);
+        });
+    }
+}
+
+void scheduler::finish(item &it, std::exception_ptr error) {
+    if (it.call_back) {
+        try {
+            it.call_back(error);
+        } catch (std::exception const &e) {
+            logger_error("Call back of a task throws: " << e.what());
+        }
+    }
+
+    release(it.bytes);
+
+    // the lock orders this after a blocked submitter checked for room
+    {
+        std::lock_guard<std::mutex> lock{room_mutex_};
+    }
+    room_cv_.notify_all();
+}
+
+} // namespace opencle
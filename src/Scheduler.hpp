@@ -1,11 +1,190 @@
+#pragma once
+
 #include <CL/cl.h>
 
-#include <queue>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Task.hpp"
+#include "scheduler_option.hpp"
+#include "util/queue/queue.hpp"
+
+namespace opencle {
+
+class device;
+class device_impl;
+
+/** Multi-device executor behind AMP. A scheduler thread places submitted
+ * tasks as HEFT does for independent tasks: those submitted together go
+ * in order of their mean predicted runtime, longest first, each on the
+ * worker of the compatible device where it would finish earliest, i.e. the
+ * predicted runtime of the work queued there (device_impl backlog), the
+ * copies the task's inputs need to get there and the runtime cost_model
+ * predicts for its kernel there. A worker keeps one queue per task_priority and
+ * runs the highest class first, earliest deadline first within a class,
+ * submission order among equal deadlines. Each device has a general worker
+ * thread and 'reserved_num' threads that only run HIGH tasks, so a short
+ * request is not stuck behind a long batch task (the kernels overlap when
+ * the device has several compute queues or an out-of-order one). An idle
+ * thread steals the most urgent task of a compatible device if the task
+ * would finish earlier on its own device; it looks for such tasks when its
+ * own queue runs dry and every idle_poll_interval. Workers of a failed device hand
+ * their tasks back to the scheduler thread. */
+class scheduler final {
+  public:
+    using Callback = std::function<void(std::exception_ptr)>;
+
+    // how often an idle worker checks the health of its device and looks
+    // for tasks to steal
+    static constexpr std::chrono::milliseconds idle_poll_interval{10};
+
+    // queued tasks per class a thief compares, the most urgent ones
+    static constexpr size_t max_steal_scan_num = 8;
+
+    // submitters wait while this many tasks are not placed yet
+    static constexpr size_t submit_capacity = 1024;
+
+    // tasks ranked against each other before they are placed
+    static constexpr size_t dispatch_batch_num = 64;
+
+  private:
+    struct item {
+        Task task;
+        Callback call_back;
+
+        // the device whose queue depth and backlog count this task, with
+        // the runtime predicted there
+        device_impl *counted_on = nullptr;
+        double cost = 0;
+
+        // pushed last by the destructor, ends the scheduler thread
+        bool is_stop = false;
+
+        // orders tasks of equal deadline by submission
+        uint64_t sequence = 0;
+
+        // footprint counted against scheduler_option::max_pending_bytes
+        size_t bytes = 0;
+    };
+
+    // earliest deadline first, then submission order
+    using ready_key = std::pair<std::chrono::steady_clock::time_point, uint64_t>;
+    using ready_queue = std::map<ready_key, item>;
+
+    struct worker {
+        device const *dev;
+        cl_device_type type;
+
+        std::mutex mutex;
+        std::array<ready_queue, task_priority_num> items;
+
+        // sizes of 'items', read by thieves without the lock
+        std::array<std::atomic<size_t>, task_priority_num> queued_nums{};
+
+        // idle threads of the worker wait under 'mutex', the general one
+        // and the reserved ones apart, so a push wakes a single thread
+        std::condition_variable general_cv;
+        std::condition_variable reserved_cv;
+
+        std::vector<std::thread> threads;
+    };
+
+    std::vector<std::unique_ptr<worker>> workers_;
+    scheduler_option option_;
+    std::atomic<uint64_t> next_sequence_;
+
+    // shared by every submitting thread and the workers handing back
+    queue<item> submitted_;
+    std::atomic<bool> stopping_;
+
+    // tasks admitted but not finished, the destructor waits for 0
+    std::atomic<size_t> pending_num_;
+    std::atomic<size_t> pending_bytes_;
+    std::mutex drain_mutex_;
+    std::condition_variable drained_cv_;
+
+    // blocked submitters, see admission_policy::BLOCK
+    std::mutex room_mutex_;
+    std::condition_variable room_cv_;
+    std::atomic<bool> dispatcher_done_;
+
+    std::thread dispatcher_;
+
+    static bool is_compatible(Task const &task, cl_device_type type);
+
+    /** device_impl::get_completion_time of 'task' on 'dev', with the copies
+     * its declared inputs need to get there. */
+    static double get_completion_time(Task const &task, device_impl const *dev);
+
+    /** Mean predicted runtime of 'task' over the compatible devices, the
+     * rank HEFT places independent tasks by. */
+    double get_rank(Task const &task) const;
+
+    // classes a thread runs, the reserved threads only take HIGH
+    static size_t get_class_num(bool is_reserved);
+
+    /** Bytes of the buffers 'task' declared with Task::uses. */
+    static size_t get_footprint(Task const &task);
+
+    // reserve / return room for one task under the limits of option_,
+    // release does not wake blocked submitters, see finish
+    bool try_admit(size_t bytes);
+    void release(size_t bytes);
+
+    void dispatch();
+    void place(item &&it);
+    void push(worker &w, item &&it);
+    bool pop(worker &w, item &it, bool is_reserved);
+    bool steal(worker &w, item &it, bool is_reserved);
+
+    // 'w' has a task a thread of the class may run, w.mutex is held
+    static bool has_queued(worker &w, bool is_reserved);
+    void run(worker &w, item &it);
+    void hand_back(worker &w);
+    void work(worker &w, bool is_reserved);
+    void finish(item &it, std::exception_ptr error);
+
+  public:
+    /** Starts a worker per device of 'devices', with option.reserved_num
+     * extra threads for HIGH tasks. The devices must stay in place (no
+     * device::sort_device_list) until the scheduler is destroyed. */
+    explicit scheduler(std::vector<device> const &devices,
+                       scheduler_option const &option = scheduler_option{});
+
+    scheduler(scheduler const &rhs) = delete;
+    scheduler(scheduler &&rhs) = delete;
+
+    /** Runs every task submitted so far, then stops the threads. */
+    ~scheduler();
+
+    scheduler &operator=(scheduler const &rhs) = delete;
+    scheduler &operator=(scheduler &&rhs) = delete;
+
+    /** Queue 'task' and return, 'call_back' is called on a worker thread
+     * with the exception the task threw, or nullptr. Lock free unless a
+     * limit of scheduler_option is reached, which then waits or throws
+     * according to scheduler_option::policy. */
+    void submit(Task task, Callback call_back);
+
+    /** Like submit, but returns false instead of waiting or throwing when
+     * the task cannot be admitted now; 'task' and 'call_back' are then
+     * left untouched. */
+    bool try_submit(Task &&task, Callback &&call_back);
 
-struct Device{
-    cl_device_id device;
-    cl_context context;
-    cl_command_queue c_queue;
+    /** Tasks admitted but not finished, and their footprint. */
+    size_t get_pending_num() const;
+    size_t get_pending_bytes() const;
 };
 
-void schedule(std::vector<Device> const &processor_list, std::queue<int> &task_queue);
\ No newline at end of file
+} // namespace opencle
@@ -1,3 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "device/device.hpp"
+#include "memory/global_ptr.hpp"
+#include "task/task.hpp"
+
 namespace opencle {
-class Task {};
-}
\ No newline at end of file
+
+class global_ptr_impl;
+
+/** Classes of AMP work, a class only runs when no task of a higher class
+ * waits on the device; HIGH also has threads of its own, see scheduler. */
+enum class task_priority { HIGH, NORMAL, LOW };
+
+constexpr size_t task_priority_num = 3;
+
+/** Work submitted through AMP::exec, run once on the device the scheduler
+ * picks, e.g. compiling a task<Args...> for it and running it there. Only
+ * devices of 'type' take the work, ALL and DEFAULT accept any device. */
+class Task {
+  public:
+    using Work = std::function<void(device const &)>;
+
+  private:
+    Work work_;
+    device_type type_;
+
+    task_priority priority_;
+    std::chrono::steady_clock::time_point deadline_;
+
+    // what placement knows about the work, see scheduler
+    std::string kernel_name_;
+    size_t work_items_;
+    std::vector<global_ptr_impl const *> inputs_;
+
+  public:
+    // deadline of a task that has none, it runs after those that have one
+    static constexpr std::chrono::steady_clock::time_point no_deadline =
+        std::chrono::steady_clock::time_point::max();
+
+    Task()
+        : work_{nullptr}, type_{device_type::ALL},
+          priority_{task_priority::NORMAL}, deadline_{no_deadline},
+          work_items_{0} {}
+
+    Task(Work work, device_type type = device_type::ALL)
+        : work_{std::move(work)}, type_{type},
+          priority_{task_priority::NORMAL}, deadline_{no_deadline},
+          work_items_{0} {}
+
+    void operator()(device const &dev) const { work_(dev); }
+
+    device_type get_device_type() const { return type_; }
+
+    Task &set_priority(task_priority priority) {
+        priority_ = priority;
+        return *this;
+    }
+
+    task_priority get_priority() const { return priority_; }
+
+    /** Within its class, the task with the earliest deadline runs first;
+     * finishing later is counted in opencle_amp_deadline_misses_total. */
+    Task &set_deadline(std::chrono::steady_clock::time_point deadline) {
+        deadline_ = deadline;
+        return *this;
+    }
+
+    std::chrono::steady_clock::time_point get_deadline() const {
+        return deadline_;
+    }
+
+    /** Identifier of the kernel the work runs and the work items it
+     * launches (its global size), so the runtime cost_model learned for
+     * them on each device (device_impl::get_runtime) counts in placement.
+     * Launches record under task<Args...>::get_kernel_identifier, any other
+     * name is never measured. Without 'work_items' the mean runtime of the
+     * kernel is used. */
+    Task &set_kernel_name(std::string const &name, size_t work_items = 0) {
+        kernel_name_ = name;
+        work_items_ = work_items;
+        return *this;
+    }
+
+    /** The same with the identifier of 'kernel', which the work runs, e.g.
+     * after compiling its own copy of it. */
+    template <typename... Args>
+    Task &set_kernel_name(task<Args...> const &kernel,
+                          size_t work_items = 0) {
+        return set_kernel_name(kernel.get_kernel_identifier(), work_items);
+    }
+
+    std::string const &get_kernel_name() const { return kernel_name_; }
+
+    size_t get_work_items() const { return work_items_; }
+
+    /** Declare a buffer the work passes to the kernel, so the copies it
+     * needs on each device count in placement. The buffer must stay alive
+     * until the work ran; tasks in flight may share it, e.g. a chain of
+     * tasks on one buffer, and are placed by where it is at the time. */
+    template <typename T> Task &uses(global_ptr<T> const &ptr) {
+        inputs_.push_back(ptr.impl_.get());
+        return *this;
+    }
+
+    std::vector<global_ptr_impl const *> const &get_inputs() const {
+        return inputs_;
+    }
+};
+
+} // namespace opencle
@@ -0,0 +1,249 @@
+#include "cost_model.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "../util/logger/logger.hpp"
+#include "device_impl.hpp"
+
+namespace
+{
+// sizes closer than this, relative to their mean, fit no slope
+constexpr double min_relative_variance = 1e-6;
+
+std::string __get_default_table_path()
+{
+    char const *path = std::getenv("OPENCLE_COST_MODEL_TABLE");
+    return path ? std::string{path} : std::string{"opencle_cost_model.txt"};
+}
+} // namespace
+
+namespace opencle
+{
+void cost_fit::add(double size, double seconds, double decay)
+{
+    weight = decay * weight + 1;
+    double size_delta = size - mean_size;
+    mean_size += size_delta / weight;
+    mean_time += (seconds - mean_time) / weight;
+    size_moment = decay * size_moment + size_delta * (size - mean_size);
+    cross_moment = decay * cross_moment + size_delta * (seconds - mean_time);
+}
+
+double cost_fit::predict(double size) const
+{
+    double variance = size_moment / weight;
+    if (size == 0 || variance <= min_relative_variance * mean_size * mean_size)
+    {
+        return mean_time;
+    }
+
+    // a runtime falling with the size is noise, not a trend
+    double slope = cross_moment / size_moment;
+    if (slope <= 0)
+    {
+        return mean_time;
+    }
+    return std::max(mean_time + slope * (size - mean_size), 0.0);
+}
+
+void cost_entry::record(size_t work_items, double seconds)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        fit_.add(static_cast<double>(work_items), seconds, cost_model::decay);
+    }
+    cost_model::unsaved_num_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool cost_entry::predict(size_t work_items, double &seconds) const
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    if (fit_.weight == 0)
+    {
+        return false;
+    }
+    seconds = fit_.predict(static_cast<double>(work_items));
+    return true;
+}
+
+std::mutex cost_model::table_mutex_ = std::mutex{};
+std::map<std::string, std::shared_ptr<cost_entry>> cost_model::table_ =
+    std::map<std::string, std::shared_ptr<cost_entry>>{};
+std::string cost_model::table_path_ = __get_default_table_path();
+bool cost_model::is_table_loaded_ = false;
+std::atomic<size_t> cost_model::unsaved_num_{0};
+std::once_flag cost_model::saver_flag_;
+std::mutex cost_model::saver_mutex_;
+std::condition_variable cost_model::saver_cv_;
+bool cost_model::is_saver_stopped_ = false;
+std::thread cost_model::saver_;
+
+void cost_model::load_table()
+{
+    logger("load_table()");
+    std::map<std::string, cost_fit> loaded;
+    std::ifstream in{table_path_};
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream entry{line};
+        std::string key;
+        cost_fit fit;
+        if (entry >> key >> fit.weight >> fit.mean_size >> fit.mean_time >> fit.size_moment >> fit.cross_moment &&
+            fit.weight > 0)
+        {
+            loaded[key] = fit;
+        }
+    }
+
+    // entries are updated in place, tasks may hold them
+    for (auto &entry : table_)
+    {
+        std::lock_guard<std::mutex> lock{entry.second->mutex_};
+        auto it = loaded.find(entry.first);
+        entry.second->fit_ = it != loaded.end() ? it->second : cost_fit{};
+    }
+    for (auto const &fit : loaded)
+    {
+        auto &entry = table_[fit.first];
+        if (!entry)
+        {
+            entry = std::make_shared<cost_entry>();
+            entry->fit_ = fit.second;
+        }
+    }
+    unsaved_num_ = 0;
+    is_table_loaded_ = true;
+    logger("Load " << loaded.size() << " entries from " << table_path_);
+}
+
+void cost_model::save_table()
+{
+    logger("save_table()");
+    unsaved_num_ = 0;
+    std::ofstream out{table_path_, std::ios::trunc};
+    if (!out)
+    {
+        logger_warn("Cannot write cost model table to " << table_path_);
+        return;
+    }
+    out.precision(17);
+    for (auto const &entry : table_)
+    {
+        cost_fit fit;
+        {
+            std::lock_guard<std::mutex> lock{entry.second->mutex_};
+            fit = entry.second->fit_;
+        }
+        if (fit.weight == 0)
+        {
+            continue;
+        }
+        out << entry.first << " " << fit.weight << " " << fit.mean_size << " " << fit.mean_time << " "
+            << fit.size_moment << " " << fit.cross_moment << "\n";
+    }
+}
+
+void cost_model::start_saver()
+{
+    logger("start_saver()");
+    saver_ = std::thread{[]() {
+        std::unique_lock<std::mutex> lock{saver_mutex_};
+        while (!is_saver_stopped_)
+        {
+            saver_cv_.wait_for(lock, save_period);
+            lock.unlock();
+            save();
+            lock.lock();
+        }
+    }};
+    // registered after the statics above are built, so it runs before they go
+    std::atexit(stop_saver);
+}
+
+void cost_model::stop_saver()
+{
+    {
+        std::lock_guard<std::mutex> lock{saver_mutex_};
+        is_saver_stopped_ = true;
+    }
+    saver_cv_.notify_all();
+    saver_.join();
+}
+
+void cost_model::set_table_path(std::string const &path)
+{
+    logger("set_table_path(std::string const &)");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    table_path_ = path;
+    load_table();
+}
+
+std::string cost_model::get_table_path()
+{
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    return table_path_;
+}
+
+std::string cost_model::make_key(std::string const &kernel, device_impl const *dev_impl)
+{
+    return kernel + "|" + dev_impl->get_identifier();
+}
+
+std::shared_ptr<cost_entry> cost_model::get_entry(std::string const &key)
+{
+    logger("get_entry(std::string const &)");
+    std::call_once(saver_flag_, start_saver);
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    if (!is_table_loaded_)
+    {
+        load_table();
+    }
+
+    auto &entry = table_[key];
+    if (!entry)
+    {
+        entry = std::make_shared<cost_entry>();
+    }
+    return entry;
+}
+
+void cost_model::record(std::string const &key, size_t work_items, double seconds)
+{
+    logger("record(std::string const &, size_t, double)");
+    get_entry(key)->record(work_items, seconds);
+}
+
+bool cost_model::predict(std::string const &key, size_t work_items, double &seconds)
+{
+    std::shared_ptr<cost_entry> entry;
+    {
+        std::lock_guard<std::mutex> lock{table_mutex_};
+        if (!is_table_loaded_)
+        {
+            load_table();
+        }
+
+        auto it = table_.find(key);
+        if (it == table_.end())
+        {
+            return false;
+        }
+        entry = it->second;
+    }
+    return entry->predict(work_items, seconds);
+}
+
+void cost_model::save()
+{
+    logger("save()");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    if (unsaved_num_ > 0)
+    {
+        save_table();
+    }
+}
+} // namespace opencle
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+struct cost_fit;
+class cost_entry;
+class cost_model;
+class device_impl;
+
+/** Least squares line of runtime against problem size, over samples whose
+ * weight decays by cost_model::decay with every newer one. Kept as centered
+ * moments, so large work item counts do not cancel out. */
+struct cost_fit
+{
+    double weight = 0;
+    double mean_size = 0;
+    double mean_time = 0;
+    double size_moment = 0;
+    double cross_moment = 0;
+
+    void add(double size, double seconds, double decay);
+
+    /** Seconds for 'size' work items, the mean runtime if the samples do
+     * not tell sizes apart or 'size' is 0 (unknown). Never negative. */
+    double predict(double size) const;
+};
+
+/** The fit of one (kernel, device) pair. Shared between the table and the
+ * tasks that launch the kernel, which keep it after compiling, so a launch
+ * only takes the lock of its own entry. */
+class cost_entry final
+{
+private:
+    mutable std::mutex mutex_;
+    cost_fit fit_;
+
+    friend class cost_model;
+
+public:
+    void record(size_t work_items, double seconds);
+
+    /** Predicted seconds of a launch of 'work_items' (0 if unknown), false
+     * if the pair has never been measured. */
+    bool predict(size_t work_items, double &seconds) const;
+};
+
+/** Learned runtime of each (kernel, device) pair as a function of the work
+ * items of a launch, fitted online from measured launches and backed by a
+ * plain text table on disk, so placement starts informed after a restart.
+ * Launches never write the table: once an entry is handed out, a thread
+ * saves it every save_period and once more at exit, and save() writes it
+ * on demand, e.g. when the last AMP goes away. */
+class cost_model final
+{
+private:
+    static std::mutex table_mutex_;
+    static std::map<std::string, std::shared_ptr<cost_entry>> table_;
+    static std::string table_path_;
+    static bool is_table_loaded_;
+    static std::atomic<size_t> unsaved_num_;
+
+    static std::once_flag saver_flag_;
+    static std::mutex saver_mutex_;
+    static std::condition_variable saver_cv_;
+    static bool is_saver_stopped_;
+    static std::thread saver_;
+
+    static void load_table();
+    static void save_table();
+    static void start_saver();
+    static void stop_saver();
+
+    friend class cost_entry;
+
+public:
+    // weight an old sample keeps for each newer one, so the fit follows
+    // drivers and clocks that change over a long run
+    static constexpr double decay = 0.95;
+
+    // what a process that does not exit normally loses at most
+    static constexpr std::chrono::seconds save_period{30};
+
+    cost_model() = delete;
+
+    /** Default path is $OPENCLE_COST_MODEL_TABLE, or "opencle_cost_model.txt"
+     * if the variable is not set. Setting a new path reloads the table,
+     * entries handed out before stay valid and take the loaded fits. */
+    static void set_table_path(std::string const &path);
+    static std::string get_table_path();
+
+    static std::string make_key(std::string const &kernel, device_impl const *dev_impl);
+
+    /** Entry of 'key', created unmeasured if the table has none. */
+    static std::shared_ptr<cost_entry> get_entry(std::string const &key);
+
+    static void record(std::string const &key, size_t work_items, double seconds);
+    static bool predict(std::string const &key, size_t work_items, double &seconds);
+
+    /** Write the table if samples were recorded since the last write. */
+    static void save();
+};
+} // namespace opencle
@@ -2,6 +2,8 @@
 
 #include <CL/cl.h>
 #include <algorithm>
+#include <random>
+#include <utility>
 
 #include "../util/logger/logger.hpp"
 #include "device_impl.hpp"
@@ -26,6 +28,81 @@ cl_device_type get_cl_device_type(opencle::device_type type)
         throw std::out_of_range{"unknown opencle device type"};
     }
 }
+
+bool __is_same_option(opencle::device_option const &lhs, opencle::device_option const &rhs)
+{
+    return lhs.out_of_order == rhs.out_of_order && lhs.profiling == rhs.profiling &&
+           lhs.compute_queue_num == rhs.compute_queue_num && lhs.upload_queue_num == rhs.upload_queue_num &&
+           lhs.download_queue_num == rhs.download_queue_num && lhs.partition == rhs.partition &&
+           lhs.partition_units == rhs.partition_units && lhs.shared_context == rhs.shared_context &&
+           lhs.benchmark == rhs.benchmark;
+}
+
+// the partition of a CPU device, or the device itself if it is not split
+std::vector<cl_device_id> __partition_device(cl_device_id dev_id, opencle::device_option const &option)
+{
+    logger("__partition_device(cl_device_id, device_option const &)");
+    cl_device_type type;
+    cl_int status = clGetDeviceInfo(dev_id, CL_DEVICE_TYPE, sizeof(cl_device_type), &type, NULL);
+    if (status != CL_SUCCESS || !(type & CL_DEVICE_TYPE_CPU) || option.partition == opencle::device_partition::NONE)
+    {
+        return {dev_id};
+    }
+
+    cl_device_partition_property properties[3] = {0, 0, 0};
+    if (option.partition == opencle::device_partition::NUMA)
+    {
+        properties[0] = CL_DEVICE_PARTITION_BY_AFFINITY_DOMAIN;
+        properties[1] = CL_DEVICE_AFFINITY_DOMAIN_NUMA;
+    }
+    else
+    {
+        properties[0] = CL_DEVICE_PARTITION_EQUALLY;
+        properties[1] = static_cast<cl_device_partition_property>(std::max<size_t>(option.partition_units, 1));
+    }
+
+    cl_uint sub_device_num = 0;
+    status = clCreateSubDevices(dev_id, properties, 0, NULL, &sub_device_num);
+    if (status != CL_SUCCESS || sub_device_num <= 1)
+    {
+        logger_debug("Keep device " << dev_id << " whole, it cannot be partitioned");
+        return {dev_id};
+    }
+
+    std::vector<cl_device_id> sub_devices(sub_device_num);
+    status = clCreateSubDevices(dev_id, properties, sub_device_num, sub_devices.data(), NULL);
+    if (status != CL_SUCCESS)
+    {
+        return {dev_id};
+    }
+    logger_info("Partition device " << dev_id << " into " << sub_device_num << " sub-devices");
+    return sub_devices;
+}
+
+size_t __get_random_index(size_t num)
+{
+    thread_local std::minstd_rand engine{std::random_device{}()};
+    return std::uniform_int_distribution<size_t>{0, num - 1}(engine);
+}
+
+// the load of a device changes while sorting, so every key is read once
+void __sort_device_list(std::vector<opencle::device> &device_list)
+{
+    std::vector<std::pair<double, size_t>> keys;
+    for (size_t i = 0; i < device_list.size(); ++i)
+    {
+        keys.emplace_back(device_list[i].get_device_impl()->get_expected_time(), i);
+    }
+    std::stable_sort(keys.begin(), keys.end());
+
+    std::vector<opencle::device> sorted;
+    sorted.reserve(device_list.size());
+    for (auto const &key : keys)
+    {
+        sorted.push_back(std::move(device_list[key.second]));
+    }
+    device_list = std::move(sorted);
+}
 } // namespace
 
 namespace opencle
@@ -33,6 +110,8 @@ namespace opencle
 std::atomic<bool> device::is_device_list_created_ = false;
 std::vector<device> device::device_list_ = std::vector<device>{};
 std::mutex device::device_list_mutex_ = std::mutex{};
+device_type device::list_type_ = device_type::DEFAULT;
+device_option device::list_option_ = device_option{};
 
 device::device(std::unique_ptr<device_impl> &&dev_impl)
     : impl_{std::move(dev_impl)}
@@ -40,16 +119,22 @@ device::device(std::unique_ptr<device_impl> &&dev_impl)
     logger("device(std::unique_ptr<device_impl> &&), create " << this);
 }
 
-void device::create_device_list(device_type type)
+void device::create_device_list(device_type type, device_option const &option)
 {
-    logger("create_device_list(device_type)");
+    logger("create_device_list(device_type, device_option const &)");
+    std::lock_guard<std::mutex> lock{device_list_mutex_};
 
     if (is_device_list_created_)
     {
-        throw std::runtime_error{"device_list_ has been created, it should not be created twice"};
+        if (type != list_type_ || !__is_same_option(option, list_option_))
+        {
+            throw std::runtime_error{"Device list is created already with another device type or device option"};
+        }
+        logger_info("Device list is created already, keep the existing one");
+        return;
     }
-
-    device_list_mutex_.lock();
+    list_type_ = type;
+    list_option_ = option;
 
     cl_int status;
 
@@ -77,53 +162,130 @@ void device::create_device_list(device_type type)
         throw std::runtime_error{"OpenCL runtime error: Cannot initialize platform"};
     }
 
+    // only ids and static info here, contexts and queues are created by
+    // device_impl on first use
+    std::vector<device> device_list;
     for (size_t i = 0; i < platform_num; ++i)
     {
         logger("getting devices on platform " << i);
 
         cl_uint device_num;
         status = clGetDeviceIDs(platforms[i], get_cl_device_type(type), 0, NULL, &device_num);
-        if (status != CL_SUCCESS)
+        if (status == CL_DEVICE_NOT_FOUND || (status == CL_SUCCESS && device_num == 0))
         {
-            throw std::runtime_error{"OpenCL runtime error: Cannot initialize device"};
+            continue;
         }
-        else if (device_num == 0)
+        else if (status != CL_SUCCESS)
         {
-            continue;
+            throw std::runtime_error{"OpenCL runtime error: Cannot initialize device"};
         }
 
         std::unique_ptr<cl_device_id[]> devices{new cl_device_id[device_num]};
         status = clGetDeviceIDs(platforms[i], get_cl_device_type(type), device_num, devices.get(), NULL);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot initialize device"};
+        }
 
+        // the spec does not say which node each NUMA sub-device covers, nor
+        // in which order they come back, so their node is left unknown
+        std::vector<cl_device_id> platform_devices;
         for (size_t j = 0; j < device_num; ++j)
         {
-            device_list_.push_back(device{std::make_unique<device_impl>(devices[i])});
+            std::vector<cl_device_id> partition = __partition_device(devices[j], option);
+            platform_devices.insert(platform_devices.end(), partition.begin(), partition.end());
+        }
+
+        std::shared_ptr<shared_context> context;
+        if (option.shared_context)
+        {
+            context = std::make_shared<shared_context>(platform_devices);
+        }
+        // device_impl retains its device, sub-devices are released here so
+        // that they live exactly as long as their device_impl
+        for (cl_device_id dev_id : platform_devices)
+        {
+            device_list.push_back(device{std::make_unique<device_impl>(dev_id, option, context)});
+            clReleaseDevice(dev_id);
         }
     }
 
-    std::sort(device_list_.begin(), device_list_.end());
+    // one device at a time: devices measured together compete for host
+    // memory, the bus and, for sub-devices, the same cores, and the skewed
+    // results would be kept in the table for every later run
+    if (option.benchmark)
+    {
+        for (auto &dev : device_list)
+        {
+            try
+            {
+                dev.impl_->benchmark();
+            }
+            catch (std::runtime_error const &e)
+            {
+                logger_warn("Cannot benchmark device " << dev.impl_->get_device_id() << ": " << e.what());
+            }
+        }
+    }
 
-    device_list_mutex_.unlock();
+    __sort_device_list(device_list);
+    device_list_ = std::move(device_list);
 
     is_device_list_created_ = true;
 }
 
+bool device::is_device_list_created()
+{
+    return is_device_list_created_;
+}
+
 std::vector<device> const &device::get_device_list() {
     return device_list_;
 }
 
 device const &device::get_top_device()
 {
-    return *device_list_.begin();
+    device const &top = *device_list_.begin();
+    top.impl_->selection_increment();
+    return top;
 }
 
 void device::sort_device_list()
 {
+    logger("sort_device_list()");
     device_list_mutex_.lock();
-    std::sort(device_list_.begin(), device_list_.end());
+    __sort_device_list(device_list_);
     device_list_mutex_.unlock();
 }
 
+device const &device::select_device()
+{
+    logger("select_device()");
+    if (!is_device_list_created_ || device_list_.empty())
+    {
+        throw std::runtime_error{"No device to select, create_device_list has not found any"};
+    }
+
+    size_t num = device_list_.size();
+    size_t first = __get_random_index(num);
+    size_t second = num > 1 ? (first + 1 + __get_random_index(num - 1)) % num : first;
+    device const &lhs = device_list_[first];
+    device const &rhs = device_list_[second];
+    device const *best = rhs.impl_->get_expected_time() < lhs.impl_->get_expected_time() ? &rhs : &lhs;
+
+    // both picks failed, fall back to any healthy device
+    for (size_t i = 0; !*best->impl_ && i < num; ++i)
+    {
+        best = &device_list_[(first + i) % num];
+    }
+    if (!*best->impl_)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Every device has failed!"};
+    }
+    best->impl_->selection_increment();
+    return *best;
+}
+
 device::device(device &&rhs) : impl_{std::move(rhs.impl_)}
 {
     logger("device(device &&rhs), create " << this << " from " << &rhs);
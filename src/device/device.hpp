@@ -5,6 +5,8 @@
 #include <atomic>
 #include <mutex>
 
+#include "device_option.hpp"
+
 namespace opencle
 {
 class device;
@@ -27,15 +29,33 @@ private:
     static std::atomic<bool> is_device_list_created_;
     static std::vector<device> device_list_;
     static std::mutex device_list_mutex_;
+    // arguments the list was created with
+    static device_type list_type_;
+    static device_option list_option_;
 
     device(std::unique_ptr<device_impl> &&dev_impl);
 
 public:
-    static void create_device_list(device_type type = device_type::DEFAULT);
+    /** Discover the devices, once per process. Calling it again with the
+     * same arguments keeps the existing list, with a different 'type' or
+     * 'option' it throws, as the list cannot be recreated. */
+    static void create_device_list(device_type type = device_type::DEFAULT,
+                                   device_option const &option = device_option{});
+    static bool is_device_list_created();
     static std::vector<device> const &get_device_list();
+
+    /** Head of the list as of the last sort_device_list. */
     static device const &get_top_device();
+
+    /** Order the list by device_impl::get_expected_time, best first. Moves
+     * the devices, so it must not run while other threads use the list. */
     static void sort_device_list();
 
+    /** Pick the less loaded of two random devices (power of two choices),
+     * comparing device_impl::get_expected_time. Takes no lock and needs no
+     * sort, so it is meant for the submit path. */
+    static device const &select_device();
+
     device(device const &rhs) = delete;
     device(device &&rhs);
     ~device();
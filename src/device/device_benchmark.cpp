@@ -0,0 +1,322 @@
+#include "device_benchmark.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "../util/logger/logger.hpp"
+#include "device_impl.hpp"
+
+namespace
+{
+constexpr size_t transfer_size = 16 << 20;
+constexpr size_t transfer_repeat_num = 4;
+constexpr size_t launch_repeat_num = 32;
+constexpr size_t compute_repeat_num = 3;
+
+// work items per compute unit and multiply-adds per work item, 4 chains so
+// the loop is not bound by the latency of a single chain
+constexpr size_t compute_item_num = 4096;
+constexpr size_t compute_fma_num = 256 * 4;
+
+std::string const benchmark_source = "__kernel void opencle_benchmark_empty() \n"
+                                     "{ \n"
+                                     "} \n"
+                                     "__kernel void opencle_benchmark_fma(__global float *out, float a, float b) \n"
+                                     "{ \n"
+                                     "    float x0 = get_global_id(0); \n"
+                                     "    float x1 = x0 + 1, x2 = x0 + 2, x3 = x0 + 3; \n"
+                                     "    for (int i = 0; i < 256; ++i) \n"
+                                     "    { \n"
+                                     "        x0 = mad(x0, a, b); \n"
+                                     "        x1 = mad(x1, a, b); \n"
+                                     "        x2 = mad(x2, a, b); \n"
+                                     "        x3 = mad(x3, a, b); \n"
+                                     "    } \n"
+                                     "    out[get_global_id(0)] = x0 + x1 + x2 + x3; \n"
+                                     "} \n";
+
+std::string __get_default_table_path()
+{
+    char const *path = std::getenv("OPENCLE_DEVICE_TABLE");
+    return path ? std::string{path} : std::string{"opencle_device.txt"};
+}
+
+void __check(cl_int status, char const *what)
+{
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{std::string{"OpenCL runtime error: "} + what};
+    }
+}
+
+double __elapsed(std::chrono::steady_clock::time_point begin)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/** Objects created by one run of the benchmark, released on every exit. */
+struct benchmark_objects
+{
+    cl_mem transfer_buffer = NULL;
+    cl_mem output_buffer = NULL;
+    cl_program program = NULL;
+    cl_kernel empty_kernel = NULL;
+    cl_kernel fma_kernel = NULL;
+
+    ~benchmark_objects()
+    {
+        for (cl_kernel kernel : {fma_kernel, empty_kernel})
+        {
+            if (kernel)
+            {
+                clReleaseKernel(kernel);
+            }
+        }
+        if (program)
+        {
+            clReleaseProgram(program);
+        }
+        for (cl_mem buffer : {output_buffer, transfer_buffer})
+        {
+            if (buffer)
+            {
+                clReleaseMemObject(buffer);
+            }
+        }
+    }
+};
+
+// best of several blocking copies, the first one also pays for allocation
+double __measure_bandwidth(cl_command_queue queue, cl_mem buffer, std::vector<char> &host, bool is_upload)
+{
+    logger("__measure_bandwidth(cl_command_queue, cl_mem, std::vector<char> &, bool)");
+    double best = 0;
+    for (size_t i = 0; i <= transfer_repeat_num; ++i)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        cl_int status = is_upload
+                            ? clEnqueueWriteBuffer(queue, buffer, CL_TRUE, 0, host.size(), host.data(), 0, NULL, NULL)
+                            : clEnqueueReadBuffer(queue, buffer, CL_TRUE, 0, host.size(), host.data(), 0, NULL, NULL);
+        __check(status, "Cannot copy benchmark buffer");
+        double seconds = __elapsed(begin);
+        if (i > 0 && seconds > 0)
+        {
+            best = std::max(best, host.size() / seconds);
+        }
+    }
+    return best;
+}
+
+double __measure_launch_latency(cl_command_queue queue, cl_kernel kernel)
+{
+    logger("__measure_launch_latency(cl_command_queue, cl_kernel)");
+    size_t global_size = 1;
+    __check(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL),
+            "Cannot launch benchmark kernel");
+    __check(clFinish(queue), "Cannot finish benchmark kernel");
+
+    auto begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < launch_repeat_num; ++i)
+    {
+        __check(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL),
+                "Cannot launch benchmark kernel");
+        __check(clFinish(queue), "Cannot finish benchmark kernel");
+    }
+    return __elapsed(begin) / launch_repeat_num;
+}
+
+double __measure_compute_throughput(cl_command_queue queue, cl_kernel kernel, size_t global_size)
+{
+    logger("__measure_compute_throughput(cl_command_queue, cl_kernel, size_t)");
+    double best = 0;
+    for (size_t i = 0; i <= compute_repeat_num; ++i)
+    {
+        auto begin = std::chrono::steady_clock::now();
+        __check(clEnqueueNDRangeKernel(queue, kernel, 1, NULL, &global_size, NULL, 0, NULL, NULL),
+                "Cannot launch benchmark kernel");
+        __check(clFinish(queue), "Cannot finish benchmark kernel");
+        double seconds = __elapsed(begin);
+        if (i > 0 && seconds > 0)
+        {
+            best = std::max(best, 2.0 * compute_fma_num * global_size / seconds);
+        }
+    }
+    return best;
+}
+} // namespace
+
+namespace opencle
+{
+bool device_performance::is_valid() const
+{
+    return upload_bandwidth > 0 && download_bandwidth > 0 && compute_throughput > 0;
+}
+
+double device_performance::get_reference_time() const
+{
+    constexpr double reference_flop = 1e9;
+    constexpr double reference_bytes = 64e6;
+    return launch_latency + reference_flop / compute_throughput + reference_bytes / upload_bandwidth +
+           reference_bytes / download_bandwidth;
+}
+
+std::mutex device_benchmark::table_mutex_ = std::mutex{};
+std::map<std::string, device_performance> device_benchmark::table_ = std::map<std::string, device_performance>{};
+std::string device_benchmark::table_path_ = __get_default_table_path();
+bool device_benchmark::is_table_loaded_ = false;
+std::mutex device_benchmark::measure_mutex_ = std::mutex{};
+
+void device_benchmark::load_table()
+{
+    logger("load_table()");
+    table_.clear();
+
+    std::ifstream in{table_path_};
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream entry{line};
+        std::string key;
+        device_performance perf;
+        if (entry >> key >> perf.upload_bandwidth >> perf.download_bandwidth >> perf.launch_latency >>
+            perf.compute_throughput)
+        {
+            table_[key] = perf;
+        }
+    }
+    is_table_loaded_ = true;
+    logger("Load " << table_.size() << " entries from " << table_path_);
+}
+
+void device_benchmark::save_table()
+{
+    logger("save_table()");
+    std::ofstream out{table_path_, std::ios::trunc};
+    if (!out)
+    {
+        logger_warn("Cannot write device table to " << table_path_);
+        return;
+    }
+    for (auto const &entry : table_)
+    {
+        out << entry.first << " " << entry.second.upload_bandwidth << " " << entry.second.download_bandwidth << " "
+            << entry.second.launch_latency << " " << entry.second.compute_throughput << "\n";
+    }
+}
+
+device_performance device_benchmark::measure(device_impl const *dev_impl)
+{
+    logger("measure(device_impl const *)");
+    cl_int status;
+    cl_context context = dev_impl->get_context();
+    cl_device_id dev_id = dev_impl->get_device_id();
+    cl_command_queue queue = dev_impl->get_command_queue();
+    size_t global_size = compute_item_num * std::max<size_t>(dev_impl->get_compute_unit_total(), 1);
+
+    benchmark_objects objects;
+    objects.transfer_buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, transfer_size, NULL, &status);
+    __check(status, "Cannot create benchmark buffer");
+    objects.output_buffer = clCreateBuffer(context, CL_MEM_WRITE_ONLY, global_size * sizeof(float), NULL, &status);
+    __check(status, "Cannot create benchmark buffer");
+
+    char const *src = benchmark_source.c_str();
+    objects.program = clCreateProgramWithSource(context, 1, &src, NULL, &status);
+    __check(status, "Cannot create benchmark program");
+    __check(clBuildProgram(objects.program, 1, &dev_id, NULL, NULL, NULL), "Cannot build benchmark program");
+    objects.empty_kernel = clCreateKernel(objects.program, "opencle_benchmark_empty", &status);
+    __check(status, "Cannot create benchmark kernel");
+    objects.fma_kernel = clCreateKernel(objects.program, "opencle_benchmark_fma", &status);
+    __check(status, "Cannot create benchmark kernel");
+
+    // a slightly contracting map, so the values neither overflow nor vanish
+    cl_float a = 0.999f, b = 0.001f;
+    __check(clSetKernelArg(objects.fma_kernel, 0, sizeof(cl_mem), &objects.output_buffer),
+            "Cannot set benchmark argument");
+    __check(clSetKernelArg(objects.fma_kernel, 1, sizeof(cl_float), &a), "Cannot set benchmark argument");
+    __check(clSetKernelArg(objects.fma_kernel, 2, sizeof(cl_float), &b), "Cannot set benchmark argument");
+
+    std::vector<char> host(transfer_size, 1);
+    device_performance perf;
+    perf.upload_bandwidth = __measure_bandwidth(queue, objects.transfer_buffer, host, true);
+    perf.download_bandwidth = __measure_bandwidth(queue, objects.transfer_buffer, host, false);
+    perf.launch_latency = __measure_launch_latency(queue, objects.empty_kernel);
+    perf.compute_throughput = __measure_compute_throughput(queue, objects.fma_kernel, global_size);
+
+    logger_info("Benchmark " << dev_impl->get_identifier() << ": upload " << perf.upload_bandwidth / 1e9
+                             << " GB/s, download " << perf.download_bandwidth / 1e9 << " GB/s, launch "
+                             << perf.launch_latency * 1e6 << " us, compute " << perf.compute_throughput / 1e9
+                             << " GFLOPS");
+    return perf;
+}
+
+void device_benchmark::set_table_path(std::string const &path)
+{
+    logger("set_table_path(std::string const &)");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    table_path_ = path;
+    load_table();
+}
+
+std::string device_benchmark::get_table_path()
+{
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    return table_path_;
+}
+
+device_performance device_benchmark::get(device_impl const *dev_impl)
+{
+    logger("get(device_impl const *)");
+    std::string key = dev_impl->get_identifier();
+    {
+        std::lock_guard<std::mutex> lock{table_mutex_};
+        if (!is_table_loaded_)
+        {
+            load_table();
+        }
+
+        auto it = table_.find(key);
+        if (it != table_.end())
+        {
+            return it->second;
+        }
+    }
+    return refresh(dev_impl);
+}
+
+device_performance device_benchmark::refresh(device_impl const *dev_impl)
+{
+    logger("refresh(device_impl const *)");
+    std::string key = dev_impl->get_identifier();
+
+    // measured without the table lock, other devices are looked up meanwhile
+    device_performance perf;
+    try
+    {
+        std::lock_guard<std::mutex> lock{measure_mutex_};
+        perf = measure(dev_impl);
+    }
+    catch (std::runtime_error const &e)
+    {
+        logger_warn("Cannot benchmark " << key << ": " << e.what());
+        return device_performance{};
+    }
+    if (!perf.is_valid())
+    {
+        return perf;
+    }
+
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    if (!is_table_loaded_)
+    {
+        load_table();
+    }
+    table_[key] = perf;
+    save_table();
+    return perf;
+}
+} // namespace opencle
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+struct device_performance;
+class device_benchmark;
+class device_impl;
+
+/** Measured characteristics of a device, zero when not measured. */
+struct device_performance
+{
+    // bytes per second of a blocking host to device / device to host copy
+    double upload_bandwidth = 0;
+    double download_bandwidth = 0;
+
+    // seconds from enqueueing an empty kernel to its completion
+    double launch_latency = 0;
+
+    // single precision multiply-add operations per second, counted as 2
+    double compute_throughput = 0;
+
+    bool is_valid() const;
+
+    /** Estimated seconds the whole device needs for a reference job of
+     * 1 GFLOP with 64 MB copied each way, lower is faster. */
+    double get_reference_time() const;
+};
+
+/** Characterizes a device with small built-in kernels and copies, backed by
+ * a plain text table on disk keyed by device name and driver version, so
+ * each device is measured once per driver. */
+class device_benchmark final
+{
+private:
+    static std::mutex table_mutex_;
+    static std::map<std::string, device_performance> table_;
+    static std::string table_path_;
+    static bool is_table_loaded_;
+
+    // held while measuring, devices are never measured at the same time
+    static std::mutex measure_mutex_;
+
+    static void load_table();
+    static void save_table();
+
+    static device_performance measure(device_impl const *dev_impl);
+
+public:
+    device_benchmark() = delete;
+
+    /** Default path is $OPENCLE_DEVICE_TABLE, or "opencle_device.txt" if
+     * the variable is not set. Setting a new path reloads the table. */
+    static void set_table_path(std::string const &path);
+    static std::string get_table_path();
+
+    /** Cached performance of the device, measured on first use. A device
+     * that fails to run the benchmark gets an invalid result. */
+    static device_performance get(device_impl const *dev_impl);
+
+    /** Measure again and replace the cached entry, e.g. after a driver
+     * setting changed without a new version string. */
+    static device_performance refresh(device_impl const *dev_impl);
+};
+} // namespace opencle
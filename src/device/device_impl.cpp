@@ -1,25 +1,90 @@
-#define NDEBUG
-
+#include <CL/cl_ext.h>
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+#include <map>
 #include <stdexcept>
+#include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
 
 #include "device_impl.hpp"
 #include "../util/logger/logger.hpp"
+#include "cost_model.hpp"
+#include "../task/program_cache.hpp"
 
 namespace
 {
-void __pfn_notify(const char *errinfo, const void *private_info, size_t cb, void *user_data)
+// copy engines of devices without a benchmark, in bytes per second
+constexpr double default_bandwidth = 1e9;
+
+// context callbacks run on a thread of the OpenCL runtime, they only count
+// the error against the device, the next command on a failed one fails over
+void __pfn_notify(const char *errinfo, const void *, size_t, void *user_data)
 {
     logger("__pfn_notify(const char *, const void *, size_t, void *)");
-    throw std::runtime_error{"OpenCL runtime error: Context failure. " + std::string{errinfo}};
+    static_cast<opencle::device_impl const *>(user_data)->report_notification(errinfo);
+}
+
+void __pfn_notify_shared(const char *errinfo, const void *, size_t, void *user_data)
+{
+    logger("__pfn_notify_shared(const char *, const void *, size_t, void *)");
+    static_cast<opencle::shared_context *>(user_data)->report_notification(errinfo);
+}
+
+// status of the device-level error a context notification describes, or
+// CL_SUCCESS for errors of a single command, e.g. an invalid argument, and
+// for any text not known to name a device error
+cl_int __get_notified_status(std::string const &errinfo)
+{
+    // whole words only, e.g. "exchange" or "reset value" name no device error
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : errinfo + " ")
+    {
+        if (std::isalnum(static_cast<unsigned char>(c)) || c == '_')
+        {
+            word += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        else if (!word.empty())
+        {
+            words.push_back(word);
+            word.clear();
+        }
+    }
+
+    static std::pair<cl_int, std::vector<std::string>> const phrases[] = {
+        {CL_OUT_OF_RESOURCES, {"cl_out_of_resources"}},
+        {CL_OUT_OF_RESOURCES, {"out", "of", "resources"}},
+        {CL_MEM_OBJECT_ALLOCATION_FAILURE, {"cl_mem_object_allocation_failure"}},
+        {CL_MEM_OBJECT_ALLOCATION_FAILURE, {"out", "of", "memory"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"cl_device_not_available"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"device", "not", "available"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"device", "lost"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"lost", "device"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"device", "reset"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"gpu", "reset"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"device", "hang"}},
+        {CL_DEVICE_NOT_AVAILABLE, {"gpu", "hang"}}};
+    for (auto const &phrase : phrases)
+    {
+        if (std::search(words.begin(), words.end(), phrase.second.begin(), phrase.second.end()) != words.end())
+        {
+            return phrase.first;
+        }
+    }
+    return CL_SUCCESS;
 }
 
-cl_context __get_context(cl_device_id const &dev_id)
+cl_context __get_context(cl_device_id const &dev_id, opencle::device_impl const *dev_impl)
 {
-    logger("__get_context(cl_device_id const &)");
+    logger("__get_context(cl_device_id const &, device_impl const *)");
     cl_int status;
-    cl_context temp = clCreateContext(NULL, 1, &dev_id, __pfn_notify, NULL, &status);
+    cl_context temp = clCreateContext(NULL, 1, &dev_id, __pfn_notify, const_cast<opencle::device_impl *>(dev_impl),
+                                      &status);
     if (status != CL_SUCCESS)
     {
         throw std::runtime_error{"OpenCL runtime error: Cannot initialize context!"};
@@ -29,11 +94,40 @@ cl_context __get_context(cl_device_id const &dev_id)
     return temp;
 }
 
-cl_command_queue __get_command_queue(cl_device_id const &dev_id, cl_context const &context)
+bool __is_out_of_order_supported(cl_device_id const &dev_id)
+{
+    logger("__is_out_of_order_supported(cl_device_id const &)");
+    cl_command_queue_properties properties;
+    cl_int status = clGetDeviceInfo(dev_id, CL_DEVICE_QUEUE_ON_HOST_PROPERTIES, sizeof(cl_command_queue_properties),
+                                    &properties, NULL);
+    return status == CL_SUCCESS && (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+}
+
+bool __is_out_of_order_queue(cl_command_queue const &cmd_q)
+{
+    logger("__is_out_of_order_queue(cl_command_queue const &)");
+    cl_command_queue_properties properties;
+    cl_int status = clGetCommandQueueInfo(cmd_q, CL_QUEUE_PROPERTIES, sizeof(cl_command_queue_properties), &properties, NULL);
+    return status == CL_SUCCESS && (properties & CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE);
+}
+
+bool __is_profiling_queue(cl_command_queue const &cmd_q)
+{
+    logger("__is_profiling_queue(cl_command_queue const &)");
+    cl_command_queue_properties properties;
+    cl_int status = clGetCommandQueueInfo(cmd_q, CL_QUEUE_PROPERTIES, sizeof(cl_command_queue_properties), &properties, NULL);
+    return status == CL_SUCCESS && (properties & CL_QUEUE_PROFILING_ENABLE);
+}
+
+cl_command_queue __get_command_queue(cl_device_id const &dev_id, cl_context const &context, bool out_of_order = false,
+                                     bool profiling = false)
 {
-    logger("__get_command_queue(cl_device_id const &, cl_context const &)");
+    logger("__get_command_queue(cl_device_id const &, cl_context const &, bool, bool)");
     cl_int status;
-    cl_command_queue temp = clCreateCommandQueueWithProperties(context, dev_id, NULL, &status);
+    cl_command_queue_properties flags = (out_of_order ? CL_QUEUE_OUT_OF_ORDER_EXEC_MODE_ENABLE : 0) |
+                                        (profiling ? CL_QUEUE_PROFILING_ENABLE : 0);
+    cl_queue_properties properties[] = {CL_QUEUE_PROPERTIES, flags, 0};
+    cl_command_queue temp = clCreateCommandQueueWithProperties(context, dev_id, flags ? properties : NULL, &status);
     if (status != CL_SUCCESS)
     {
         throw std::runtime_error{"OpenCL runtime error: Cannot initialize command queue!"};
@@ -43,6 +137,72 @@ cl_command_queue __get_command_queue(cl_device_id const &dev_id, cl_context cons
     return temp;
 }
 
+std::vector<cl_command_queue> __get_command_queues(cl_device_id const &dev_id, cl_context const &context, size_t num,
+                                                   bool out_of_order = false, bool profiling = false)
+{
+    logger("__get_command_queues(cl_device_id const &, cl_context const &, size_t, bool, bool)");
+    std::vector<cl_command_queue> queues;
+    try
+    {
+        for (size_t i = 0; i < num; ++i)
+        {
+            queues.push_back(__get_command_queue(dev_id, context, out_of_order, profiling));
+        }
+    }
+    catch (std::runtime_error const &)
+    {
+        for (auto &queue : queues)
+        {
+            clReleaseCommandQueue(queue);
+        }
+        throw;
+    }
+    return queues;
+}
+
+void __release_command_queues(std::vector<cl_command_queue> const &queues)
+{
+    for (auto &queue : queues)
+    {
+        clReleaseCommandQueue(queue);
+        logger("Release command queue " << queue);
+    }
+}
+
+bool __is_sub_device(cl_device_id const &dev_id)
+{
+    logger("__is_sub_device(cl_device_id const &)");
+    cl_device_id parent = NULL;
+    cl_int status = clGetDeviceInfo(dev_id, CL_DEVICE_PARENT_DEVICE, sizeof(cl_device_id), &parent, NULL);
+    return status == CL_SUCCESS && parent != NULL;
+}
+
+int __get_numa_node(cl_device_id const &dev_id)
+{
+    logger("__get_numa_node(cl_device_id const &)");
+#ifdef CL_DEVICE_PCI_BUS_INFO_KHR
+    // same layout as cl_device_pci_bus_info_khr, which older headers lack
+    struct
+    {
+        cl_uint domain, bus, device, function;
+    } pci;
+    if (clGetDeviceInfo(dev_id, CL_DEVICE_PCI_BUS_INFO_KHR, sizeof(pci), &pci, NULL) != CL_SUCCESS)
+    {
+        return -1;
+    }
+
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/bus/pci/devices/%04x:%02x:%02x.%x/numa_node", pci.domain, pci.bus, pci.device,
+             pci.function);
+    int numa_node = -1;
+    std::ifstream in{path};
+    in >> numa_node;
+    return in ? numa_node : -1;
+#else
+    return -1;
+#endif
+}
+
 size_t __get_compute_unit(cl_device_id const &dev_id)
 {
     logger("__get_compute_unit(cl_device_id const &)");
@@ -57,42 +217,217 @@ size_t __get_compute_unit(cl_device_id const &dev_id)
 
     return static_cast<size_t>(cu_num);
 }
+
+std::string __get_device_label(cl_device_id const &dev_id)
+{
+    char device_name[100] = {};
+    clGetDeviceInfo(dev_id, CL_DEVICE_NAME, sizeof(device_name) - 1, device_name, NULL);
+    return opencle::metrics::label("device", device_name);
+}
+
+opencle::gauge &__get_queue_depth(cl_device_id const &dev_id)
+{
+    logger("__get_queue_depth(cl_device_id const &)");
+    return opencle::metrics::get_gauge("opencle_queue_depth", "Launches in flight per device",
+                                       __get_device_label(dev_id));
+}
+
+opencle::counter &__get_failures(cl_device_id const &dev_id)
+{
+    logger("__get_failures(cl_device_id const &)");
+    return opencle::metrics::get_counter("opencle_device_failures_total", "Times the device was taken out of scheduling",
+                                         __get_device_label(dev_id));
+}
+
+opencle::counter &__get_selections(cl_device_id const &dev_id)
+{
+    logger("__get_selections(cl_device_id const &)");
+    return opencle::metrics::get_counter("opencle_device_selections_total", "Times the device was picked to run work",
+                                         __get_device_label(dev_id));
+}
 } // namespace
 
 namespace opencle
 {
-device_impl::device_impl(cl_device_id const &dev_id)
-    : device_{dev_id}, context_{__get_context(device_)},
-      cmd_queue_{__get_command_queue(device_, context_)},
-      cu_total_{__get_compute_unit(device_)},
-      valid_{true}, cu_used_{0}
+shared_context::shared_context(std::vector<cl_device_id> devices)
+    : devices_{std::move(devices)}, init_flag_{}, context_{nullptr}
+{
+    logger("shared_context(std::vector<cl_device_id>), create " << this);
+}
+
+shared_context::~shared_context()
+{
+    logger("~shared_context(), destory " << this);
+    if (context_)
+    {
+        clReleaseContext(context_);
+        logger("Release context " << context_);
+    }
+}
+
+cl_context shared_context::get()
+{
+    std::call_once(init_flag_, [this]() {
+        logger("get(), create context on " << devices_.size() << " devices");
+        cl_int status;
+        cl_context temp =
+            clCreateContext(NULL, devices_.size(), devices_.data(), __pfn_notify_shared, this, &status);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot initialize context!"};
+        }
+        context_ = temp;
+    });
+    return context_;
+}
+
+void shared_context::add_member(device_impl const *dev_impl)
+{
+    logger("add_member(device_impl const *)");
+    std::lock_guard<std::mutex> lock{members_mutex_};
+    members_.push_back(dev_impl);
+}
+
+void shared_context::remove_member(device_impl const *dev_impl)
+{
+    logger("remove_member(device_impl const *)");
+    std::lock_guard<std::mutex> lock{members_mutex_};
+    members_.erase(std::remove(members_.begin(), members_.end(), dev_impl), members_.end());
+}
+
+void shared_context::report_notification(char const *errinfo)
+{
+    std::lock_guard<std::mutex> lock{members_mutex_};
+    for (auto const *member : members_)
+    {
+        member->report_notification(errinfo);
+    }
+}
+
+struct device_impl::transfer_record
+{
+    device_impl const *dev_impl;
+    size_t bytes;
+};
+
+device_impl::device_impl(cl_device_id const &dev_id, device_option const &option,
+                         std::shared_ptr<shared_context> context)
+    : device_{dev_id}, is_sub_device_{__is_sub_device(dev_id)}, option_{option}, shared_context_{std::move(context)},
+      out_of_order_{option.out_of_order && __is_out_of_order_supported(device_)}, profiling_{option.profiling},
+      init_flag_{}, initialized_{false}, context_{nullptr}, compute_queues_{}, upload_queues_{}, download_queues_{},
+      next_compute_{0}, next_upload_{0}, next_download_{0},
+      cu_total_{__get_compute_unit(device_)}, numa_node_{__get_numa_node(device_)}, performance_{},
+      valid_{true}, cu_used_{0}, error_num_{0}, failures_{__get_failures(device_)}, launch_num_{0},
+      transfer_bytes_{0}, queue_depth_{__get_queue_depth(device_)}, selections_{__get_selections(device_)},
+      backlog_ns_{0}
 {
     logger("device_impl(device_id const &), create " << this);
+    // a no-op for root devices, keeps a sub-device alive
+    clRetainDevice(device_);
     return;
 }
 
 device_impl::device_impl(cl_device_id const &dev_id, cl_context const &context, cl_command_queue const &cmd_q)
-    : device_{dev_id}, context_{context}, cmd_queue_{cmd_q},
-      cu_total_{__get_compute_unit(dev_id)},
-      valid_{true}, cu_used_{0}
+    : device_{dev_id}, is_sub_device_{__is_sub_device(dev_id)}, option_{}, shared_context_{nullptr}, out_of_order_{__is_out_of_order_queue(cmd_q)},
+      profiling_{__is_profiling_queue(cmd_q)}, init_flag_{}, initialized_{true}, context_{context},
+      compute_queues_{cmd_q}, upload_queues_{}, download_queues_{}, next_compute_{0}, next_upload_{0},
+      next_download_{0}, cu_total_{__get_compute_unit(dev_id)}, numa_node_{__get_numa_node(dev_id)},
+      performance_{},
+      valid_{true}, cu_used_{0}, error_num_{0}, failures_{__get_failures(dev_id)}, launch_num_{0},
+      transfer_bytes_{0}, queue_depth_{__get_queue_depth(dev_id)}, selections_{__get_selections(dev_id)},
+      backlog_ns_{0}
 {
     logger("device_impl(device_id const &, context const &, command_queue const &), create " << this);
+    clRetainDevice(device_);
+    std::call_once(init_flag_, []() {});
     return;
 }
 
 device_impl::~device_impl()
 {
     logger("~device_impl(), destory " << this);
-    clReleaseCommandQueue(cmd_queue_);
-    logger("Release command queue " << cmd_queue_);
-    clReleaseContext(context_);
-    logger("Release context " << context_);
+    if (initialized_)
+    {
+        if (shared_context_)
+        {
+            shared_context_->remove_member(this);
+        }
+        // completion callbacks of tracked copies still point at this object
+        finish();
+        while (transfer_bytes_ > 0)
+        {
+            std::this_thread::yield();
+        }
+        __release_command_queues(compute_queues_);
+        __release_command_queues(upload_queues_);
+        __release_command_queues(download_queues_);
+        program_cache::evict(context_, device_);
+        clReleaseContext(context_);
+        logger("Release context " << context_);
+    }
+    clReleaseDevice(device_);
+}
+
+void device_impl::initialize() const
+{
+    // a throwing call leaves the flag unset, the next caller tries again
+    std::call_once(init_flag_, [this]() {
+        logger("initialize() const, on " << this);
+        cl_context context;
+        if (shared_context_)
+        {
+            // each device holds its own reference, released like a private one
+            context = shared_context_->get();
+            clRetainContext(context);
+        }
+        else
+        {
+            context = __get_context(device_, this);
+        }
+        try
+        {
+            compute_queues_ = __get_command_queues(device_, context, std::max<size_t>(option_.compute_queue_num, 1),
+                                                   out_of_order_, profiling_);
+            upload_queues_ = __get_command_queues(device_, context, option_.upload_queue_num, false, profiling_);
+            download_queues_ = __get_command_queues(device_, context, option_.download_queue_num, false, profiling_);
+        }
+        catch (std::runtime_error const &)
+        {
+            __release_command_queues(compute_queues_);
+            __release_command_queues(upload_queues_);
+            compute_queues_.clear();
+            upload_queues_.clear();
+            clReleaseContext(context);
+            throw;
+        }
+        // only a device that is set up fails with the context
+        if (shared_context_)
+        {
+            shared_context_->add_member(this);
+        }
+        context_ = context;
+        initialized_ = true;
+    });
+}
+
+bool device_impl::is_initialized() const
+{
+    logger("is_initialized() const");
+    return initialized_;
+}
+
+void device_impl::benchmark()
+{
+    logger("benchmark()");
+    performance_ = device_benchmark::get(this);
 }
 
 bool device_impl::operator<(device_impl const &rhs) const
 {
     logger("operator<(device_impl const &) const, compare " << this << " and " << &rhs);
-    return valid_ * (cu_total_ - cu_used_) < rhs.valid_ * (rhs.cu_total_ - rhs.cu_used_);
+    // one key in seconds for measured and unmeasured devices alike, so the
+    // order stays a strict weak ordering for any mix of them
+    return get_expected_time() > rhs.get_expected_time();
 }
 
 device_impl::operator bool() const
@@ -107,16 +442,100 @@ cl_device_id device_impl::get_device_id() const
     return device_;
 }
 
+bool device_impl::is_sub_device() const
+{
+    logger("is_sub_device() const");
+    return is_sub_device_;
+}
+
+int device_impl::get_numa_node() const
+{
+    logger("get_numa_node() const");
+    return numa_node_;
+}
+
+void device_impl::set_numa_node(int numa_node)
+{
+    logger("set_numa_node(int)");
+    numa_node_ = numa_node;
+}
+
 cl_context device_impl::get_context() const
 {
     logger("get_context() const");
+    initialize();
     return context_;
 }
 
 cl_command_queue device_impl::get_command_queue() const
 {
     logger("get_command_queue() const");
-    return cmd_queue_;
+    initialize();
+    return compute_queues_.front();
+}
+
+cl_command_queue device_impl::get_compute_queue() const
+{
+    logger("get_compute_queue() const");
+    initialize();
+    return compute_queues_[next_compute_.fetch_add(1) % compute_queues_.size()];
+}
+
+cl_command_queue device_impl::get_upload_queue() const
+{
+    logger("get_upload_queue() const");
+    initialize();
+    if (upload_queues_.empty())
+    {
+        return get_compute_queue();
+    }
+    return upload_queues_[next_upload_.fetch_add(1) % upload_queues_.size()];
+}
+
+cl_command_queue device_impl::get_download_queue() const
+{
+    logger("get_download_queue() const");
+    initialize();
+    if (download_queues_.empty())
+    {
+        return get_compute_queue();
+    }
+    return download_queues_[next_download_.fetch_add(1) % download_queues_.size()];
+}
+
+void device_impl::finish() const
+{
+    logger("finish() const");
+    if (!initialized_)
+    {
+        return;
+    }
+    for (auto const *queues : {&compute_queues_, &upload_queues_, &download_queues_})
+    {
+        for (auto &queue : *queues)
+        {
+            clFinish(queue);
+        }
+    }
+}
+
+bool device_impl::is_out_of_order() const
+{
+    logger("is_out_of_order() const");
+    return out_of_order_;
+}
+
+bool device_impl::is_profiling() const
+{
+    logger("is_profiling() const");
+    return profiling_;
+}
+
+bool device_impl::is_ordered() const
+{
+    logger("is_ordered() const");
+    return !out_of_order_ && option_.compute_queue_num <= 1 && option_.upload_queue_num == 0 &&
+           option_.download_queue_num == 0;
 }
 
 int device_impl::get_compute_unit_available() const
@@ -125,10 +544,240 @@ int device_impl::get_compute_unit_available() const
     return static_cast<int>(cu_total_) - static_cast<int>(cu_used_);
 }
 
+size_t device_impl::get_compute_unit_total() const
+{
+    logger("get_compute_unit_total() const");
+    return cu_total_;
+}
+
+device_performance const &device_impl::get_performance() const
+{
+    logger("get_performance() const");
+    return performance_;
+}
+
+double device_impl::get_score() const
+{
+    logger("get_score() const");
+    double available = valid_ ? std::max(get_compute_unit_available(), 0) : 0;
+    if (!performance_.is_valid())
+    {
+        return available;
+    }
+    return available / std::max<size_t>(cu_total_, 1) / performance_.get_reference_time();
+}
+
+std::string const &device_impl::get_identifier() const
+{
+    logger("get_identifier() const");
+    // a throwing query leaves the flag unset, the next caller tries again
+    std::call_once(identifier_flag_, [this]() {
+        cl_int status;
+
+        char device_name[100];
+        status = clGetDeviceInfo(device_, CL_DEVICE_NAME, 100, device_name, NULL);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot get device info"};
+        }
+
+        char driver_version[100];
+        status = clGetDeviceInfo(device_, CL_DRIVER_VERSION, 100, driver_version, NULL);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot get device info"};
+        }
+
+        std::string identifier = std::string{device_name} + "/" + std::string{driver_version};
+        if (is_sub_device_)
+        {
+            // sub-devices of one device differ only in size
+            identifier += "#" + std::to_string(cu_total_);
+        }
+        for (auto &c : identifier)
+        {
+            if (c == ' ' || c == '\t')
+            {
+                c = '_';
+            }
+        }
+        identifier_ = identifier;
+    });
+    return identifier_;
+}
+
 void device_impl::compute_unit_usage_increment(int offset)
 {
     logger("computate_unit_usage_increment(int)");
-    cu_used_ = cu_used_ + offset;
+    cu_used_.fetch_add(offset);
+}
+
+void device_impl::queue_depth_increment(int offset)
+{
+    logger("queue_depth_increment(int)");
+    launch_num_.fetch_add(offset, std::memory_order_relaxed);
+    queue_depth_.add(offset);
+}
+
+int64_t device_impl::get_queue_depth() const
+{
+    logger("get_queue_depth() const");
+    return launch_num_.load(std::memory_order_relaxed);
+}
+
+void device_impl::on_transfer_complete(cl_event, cl_int, void *user_data)
+{
+    transfer_record *rec = static_cast<transfer_record *>(user_data);
+    rec->dev_impl->transfer_bytes_.fetch_sub(rec->bytes, std::memory_order_relaxed);
+    delete rec;
+}
+
+void device_impl::track_transfer(size_t bytes, cl_event event) const
+{
+    logger("track_transfer(size_t, cl_event) const");
+    transfer_bytes_.fetch_add(bytes, std::memory_order_relaxed);
+    transfer_record *rec = new transfer_record{this, bytes};
+    if (clSetEventCallback(event, CL_COMPLETE, on_transfer_complete, rec) != CL_SUCCESS)
+    {
+        transfer_bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+        delete rec;
+    }
+}
+
+int64_t device_impl::get_outstanding_bytes() const
+{
+    logger("get_outstanding_bytes() const");
+    return transfer_bytes_.load(std::memory_order_relaxed);
+}
+
+double device_impl::get_job_time() const
+{
+    // unmeasured devices assume one second per job on one compute unit,
+    // which keeps the old compute unit ranking
+    double available = std::max(get_compute_unit_available(), 1);
+    if (performance_.is_valid())
+    {
+        return performance_.get_reference_time() * cu_total_ / available;
+    }
+    return 1.0 / available;
+}
+
+double device_impl::get_upload_time(size_t bytes) const
+{
+    return bytes / (performance_.is_valid() ? performance_.upload_bandwidth : default_bandwidth);
+}
+
+double device_impl::get_download_time(size_t bytes) const
+{
+    return bytes / (performance_.is_valid() ? performance_.download_bandwidth : default_bandwidth);
+}
+
+double device_impl::get_expected_time() const
+{
+    logger("get_expected_time() const");
+    if (!valid_)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    return (get_queue_depth() + 1) * get_job_time() + get_upload_time(get_outstanding_bytes());
+}
+
+void device_impl::record_runtime(std::string const &kernel, size_t work_items, double seconds)
+{
+    logger("record_runtime(std::string const &, size_t, double)");
+    cost_model::record(cost_model::make_key(kernel, this), work_items, seconds);
+}
+
+double device_impl::get_runtime(std::string const &kernel, size_t work_items) const
+{
+    logger("get_runtime(std::string const &, size_t) const");
+    double seconds;
+    if (cost_model::predict(cost_model::make_key(kernel, this), work_items, seconds))
+    {
+        return seconds;
+    }
+    return get_job_time();
+}
+
+double device_impl::get_runtime(cost_entry const &entry, size_t work_items) const
+{
+    double seconds;
+    return entry.predict(work_items, seconds) ? seconds : get_job_time();
+}
+
+void device_impl::backlog_increment(double seconds)
+{
+    logger("backlog_increment(double)");
+    backlog_ns_.fetch_add(static_cast<int64_t>(seconds * 1e9), std::memory_order_relaxed);
+}
+
+double device_impl::get_backlog_time() const
+{
+    logger("get_backlog_time() const");
+    return std::max<int64_t>(backlog_ns_.load(std::memory_order_relaxed), 0) / 1e9;
+}
+
+double device_impl::get_completion_time(std::string const &kernel, size_t work_items, double transfer_time) const
+{
+    logger("get_completion_time(std::string const &, size_t, double) const");
+    if (!valid_)
+    {
+        return std::numeric_limits<double>::infinity();
+    }
+    return get_backlog_time() + get_upload_time(get_outstanding_bytes()) + transfer_time +
+           get_runtime(kernel, work_items);
+}
+
+void device_impl::selection_increment() const
+{
+    logger("selection_increment() const");
+    selections_.add();
+}
+
+void device_impl::mark_failed(std::string const &reason) const
+{
+    if (valid_.exchange(false))
+    {
+        failures_.add();
+        logger_error("Device " << device_ << " failed, no more work is sent to it: " << reason);
+    }
+}
+
+void device_impl::report_notification(char const *errinfo) const
+{
+    std::string message = errinfo ? errinfo : "";
+    cl_int status = __get_notified_status(message);
+    if (status == CL_SUCCESS)
+    {
+        logger_warn("Device " << device_ << " reports: " << message);
+        return;
+    }
+    logger_warn("Device " << device_ << " reports a device error: " << message);
+    report_status(status);
+}
+
+void device_impl::report_status(cl_int status) const
+{
+    switch (status)
+    {
+    case CL_SUCCESS:
+        error_num_ = 0;
+        break;
+    case CL_DEVICE_NOT_AVAILABLE:
+    case CL_OUT_OF_RESOURCES:
+    case CL_MEM_OBJECT_ALLOCATION_FAILURE:
+        if (error_num_.fetch_add(1) + 1 >= max_error_num)
+        {
+            mark_failed("OpenCL error " + std::to_string(status) + " on " + std::to_string(max_error_num) +
+                        " commands in a row");
+        }
+        break;
+    default:
+        // errors of the command itself say nothing about the device, nor
+        // does CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST, where a command
+        // it waited for failed, maybe on another device
+        break;
+    }
 }
 
 std::ostream &operator<<(std::ostream &out, device_impl const &dev_impl)
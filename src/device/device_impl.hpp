@@ -2,29 +2,113 @@
 
 #include <CL/cl.h>
 #include <atomic>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 #include "../util/core_def.hpp"
+#include "../util/metrics/metrics.hpp"
+#include "device_benchmark.hpp"
+#include "device_option.hpp"
 
 namespace opencle
 {
+class shared_context;
 class device_impl;
+class cost_entry;
+
+/** One context covering every device of a platform, created when the first
+ * of them is initialized. */
+class shared_context final
+{
+private:
+    std::vector<cl_device_id> devices_;
+    std::once_flag init_flag_;
+    cl_context context_;
+
+    // initialized devices, all of them fail with the context
+    std::mutex members_mutex_;
+    std::vector<device_impl const *> members_;
+
+public:
+    explicit shared_context(std::vector<cl_device_id> devices);
+    shared_context(shared_context const &rhs) = delete;
+    ~shared_context();
+
+    shared_context &operator=(shared_context const &rhs) = delete;
+
+    /** The context, the caller retains it to keep a reference. */
+    cl_context get();
+
+    void add_member(device_impl const *dev_impl);
+    void remove_member(device_impl const *dev_impl);
+
+    /** Pass a notification of the context to every member, see
+     * device_impl::report_notification. */
+    void report_notification(char const *errinfo);
+};
 
 class device_impl final
 {
 private:
     cl_device_id device_;
-    cl_context context_;
-    cl_command_queue cmd_queue_;
+    bool is_sub_device_;
+    device_option option_;
+    std::shared_ptr<shared_context> shared_context_;
+    bool out_of_order_;
+    bool profiling_;
+
+    // created on first use by initialize(), so listing devices is cheap
+    mutable std::once_flag init_flag_;
+    mutable std::atomic<bool> initialized_;
+    mutable cl_context context_;
+    mutable std::vector<cl_command_queue> compute_queues_;
+    mutable std::vector<cl_command_queue> upload_queues_;
+    mutable std::vector<cl_command_queue> download_queues_;
+
+    mutable std::atomic<size_t> next_compute_;
+    mutable std::atomic<size_t> next_upload_;
+    mutable std::atomic<size_t> next_download_;
 
     size_t cu_total_;
+    int numa_node_;
+    device_performance performance_;
 
     mutable std::atomic<bool> valid_;
     std::atomic<size_t> cu_used_;
 
+    // device errors in a row, see report_status
+    mutable std::atomic<size_t> error_num_;
+    counter &failures_;
+
+    // load read by device::select_device, updated without locks
+    std::atomic<int64_t> launch_num_;
+    mutable std::atomic<int64_t> transfer_bytes_;
+
+    gauge &queue_depth_;
+    counter &selections_;
+
+    // predicted seconds of the launches queued on the device, see
+    // backlog_increment
+    std::atomic<int64_t> backlog_ns_;
+
+    // keys of device_benchmark and cost_model, queried once
+    mutable std::once_flag identifier_flag_;
+    mutable std::string identifier_;
+
+    double get_job_time() const;
+
+    struct transfer_record;
+    static void on_transfer_complete(cl_event event, cl_int status, void *user_data);
+
 public:
-    device_impl(cl_device_id const &dev_id);
+    // device errors in a row before the device is taken out of scheduling
+    static constexpr size_t max_error_num = 3;
+
+    device_impl(cl_device_id const &dev_id, device_option const &option = device_option{},
+                std::shared_ptr<shared_context> context = nullptr);
     device_impl(cl_device_id const &dev_id, cl_context const &context, cl_command_queue const &cmd_q);
     device_impl(device_impl const &rhs) = delete;
     device_impl(device_impl &&rhs) = delete;
@@ -32,16 +116,128 @@ public:
 
     device_impl &operator=(device_impl const &rhs) = delete;
     device_impl &operator=(device_impl &&rhs) = delete;
+
+    /** Whether the device would finish a new job later than 'rhs', by
+     * get_expected_time; the load changes meanwhile, so a sort reads each
+     * key once instead, see device::sort_device_list. */
     bool operator<(device_impl const &rhs) const;
     operator bool() const;
 
+    /** Create the context and queues if not done yet, every accessor of
+     * them calls it. Safe to call from several threads at once. */
+    void initialize() const;
+    bool is_initialized() const;
+
+    /** Look the device up in device_benchmark, measuring it if the table
+     * has no entry, and use the result for ranking. */
+    void benchmark();
+
     cl_device_id get_device_id() const;
     cl_context get_context() const;
+
+    /** Whether the device is a partition of another one, see
+     * device_option::partition. */
+    bool is_sub_device() const;
+
+    /** NUMA node the device is attached to, from the PCI bus of a discrete
+     * device; -1 if unknown, as for CPU sub-devices unless the node is set
+     * by the caller. */
+    int get_numa_node() const;
+    void set_numa_node(int numa_node);
     cl_command_queue get_command_queue() const;
+
+    /** Queues handed out round-robin. Commands on different queues are only
+     * ordered by events, see global_ptr_impl::get_wait_list. */
+    cl_command_queue get_compute_queue() const;
+    cl_command_queue get_upload_queue() const;
+    cl_command_queue get_download_queue() const;
+
+    /** Block until every queue of the device is empty. */
+    void finish() const;
+
+    bool is_out_of_order() const;
+    bool is_profiling() const;
+
+    /** Whether every command goes through a single in-order queue, so that
+     * enqueue order alone orders them. */
+    bool is_ordered() const;
     int get_compute_unit_available() const; 
+    size_t get_compute_unit_total() const;
+
+    /** Result of device_benchmark, invalid if the device was created
+     * without benchmarking. */
+    device_performance const &get_performance() const;
+
+    /** Throughput rank, higher is better. Measured devices are ranked by
+     * the reference job time scaled by the share of compute units still
+     * free, otherwise by the number of free compute units, so the two are
+     * not comparable with each other; ordering uses get_expected_time. */
+    double get_score() const;
+    std::string const &get_identifier() const;
 
     void compute_unit_usage_increment(int offset);
 
+    /** Launches submitted to the device and not completed yet. */
+    void queue_depth_increment(int offset);
+    int64_t get_queue_depth() const;
+
+    /** Count 'bytes' as outstanding until 'event' completes, for copies
+     * that are enqueued without waiting for them. */
+    void track_transfer(size_t bytes, cl_event event) const;
+    int64_t get_outstanding_bytes() const;
+
+    /** Estimated seconds until a new reference job (see device_performance)
+     * would finish behind the launches and copies already submitted, lower
+     * is better. Infinite for an invalid device. */
+    double get_expected_time() const;
+
+    /** Seconds to copy 'bytes' to / from the device, by the benchmarked
+     * bandwidth, or 1 GB/s when the device is not measured. */
+    double get_upload_time(size_t bytes) const;
+    double get_download_time(size_t bytes) const;
+
+    /** Add a measured launch of 'kernel' over 'work_items' to its
+     * cost_model fit on this device, 'kernel' being an identifier as of
+     * task_impl::get_kernel_identifier. */
+    void record_runtime(std::string const &kernel, size_t work_items, double seconds);
+
+    /** Runtime of 'kernel' over 'work_items' (0 if unknown) predicted by
+     * cost_model, or the time of a reference job if it never ran here. */
+    double get_runtime(std::string const &kernel, size_t work_items = 0) const;
+
+    /** The same from an entry of cost_model held by the caller, without
+     * looking the kernel up, for the launch path. */
+    double get_runtime(cost_entry const &entry, size_t work_items) const;
+
+    /** Predicted seconds of launches queued on the device and not finished,
+     * added by whoever queues them and removed when they start or finish. */
+    void backlog_increment(double seconds);
+    double get_backlog_time() const;
+
+    /** Estimated seconds until 'kernel' would finish if submitted now: the
+     * backlog, 'transfer_time' to move its arguments here and its predicted
+     * runtime. Infinite for an invalid device. */
+    double get_completion_time(std::string const &kernel, size_t work_items, double transfer_time) const;
+
+    /** Counts the device being picked to run work. */
+    void selection_increment() const;
+
+    /** Take the device out of scheduling: it ranks last, select_device
+     * skips it, and buffers on it are recovered to the host on their next
+     * use. Called from the context callback as well, so it never throws. */
+    void mark_failed(std::string const &reason) const;
+
+    /** Status of a command on the device. A failure that points at the
+     * device rather than the command, e.g. CL_OUT_OF_RESOURCES, counts
+     * towards max_error_num; a success resets the count. */
+    void report_status(cl_int status) const;
+
+    /** Message of a context notification. Drivers also notify errors of
+     * single commands, so only a message naming a device-level error in
+     * whole words, e.g. CL_OUT_OF_RESOURCES or "device lost", goes to
+     * report_status; any other text is logged and taken as transient. */
+    void report_notification(char const *errinfo) const;
+
     friend std::ostream &operator<<(std::ostream &out, device_impl const &dev_impl);
 };
 } // namespace opencle
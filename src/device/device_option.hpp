@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+
+namespace opencle
+{
+struct device_option;
+
+/** How a CPU device is split into sub-devices, each of them is listed as
+ * a device of its own. */
+enum class device_partition
+{
+    // the whole device
+    NONE,
+
+    // one sub-device per NUMA node, so a task stays on one socket; devices
+    // that cannot be split this way are kept whole
+    NUMA,
+
+    // sub-devices of device_option::partition_units compute units each
+    EQUALLY
+};
+
+/** How device_impl sets up its OpenCL objects, passed through
+ * device::create_device_list. */
+struct device_option
+{
+    // use an out-of-order command queue if the device supports it, ordering
+    // is then expressed only through the events of global_ptr_impl
+    bool out_of_order = false;
+
+    // create every queue with CL_QUEUE_PROFILING_ENABLE and record the
+    // commands of task_impl and global_ptr_impl in the profiler
+    bool profiling = false;
+
+    // kernels are spread round-robin over the compute queues
+    size_t compute_queue_num = 1;
+
+    // dedicated in-order queues for host to device and device to host copies,
+    // so transfers overlap with kernels on devices with separate copy
+    // engines; 0 means copies go through the compute queues
+    size_t upload_queue_num = 0;
+    size_t download_queue_num = 0;
+
+    // only CPU devices are partitioned, other devices are always whole
+    device_partition partition = device_partition::NUMA;
+    size_t partition_units = 1;
+
+    // one context for all devices of a platform instead of one per device,
+    // so buffers move between them without a copy through the host and a
+    // program is built once for all of them
+    bool shared_context = false;
+
+    // characterize the devices with device_benchmark in create_device_list,
+    // so they are ranked by measured speed instead of compute unit count;
+    // results are cached on disk, only the first run per device and driver
+    // pays for it and creates the context up front
+    bool benchmark = true;
+};
+} // namespace opencle
@@ -29,6 +29,8 @@ template <typename T>
 using global_ptr_t = typename resolve_global_ptr<T>::type;
 
 template <typename T, typename X = void> class global_ptr;
+template <typename T, typename X> struct argument_binder;
+class Task;
 
 template <typename T> class global_ptr<T[], std::enable_if_t<std::is_pod_v<T>>> final {
 private:
@@ -192,6 +194,8 @@ public:
     }
 
     friend class device_impl;
+    friend class Task;
+    template <typename, typename> friend struct argument_binder;
     
     friend void ::opencle_test::test();
 };
@@ -4,13 +4,59 @@
 
 #include "../device/device_impl.hpp"
 #include "../util/logger/logger.hpp"
+#include "../util/metrics/metrics.hpp"
+#include "../util/profiler/profiler.hpp"
+#include "../util/trace/trace.hpp"
 #include "global_ptr_impl.hpp"
+#include "host_allocator.hpp"
+
+namespace
+{
+struct memory_metrics
+{
+    opencle::counter &upload_bytes =
+        opencle::metrics::get_counter("opencle_upload_bytes_total", "Bytes copied from host to device");
+    opencle::counter &uploads = opencle::metrics::get_counter("opencle_uploads_total", "Host to device copies");
+    opencle::counter &download_bytes =
+        opencle::metrics::get_counter("opencle_download_bytes_total", "Bytes copied from device to host");
+    opencle::counter &downloads = opencle::metrics::get_counter("opencle_downloads_total", "Device to host copies");
+    opencle::counter &allocations =
+        opencle::metrics::get_counter("opencle_buffer_allocations_total", "Device buffers created");
+    opencle::counter &frees = opencle::metrics::get_counter("opencle_buffer_frees_total", "Device buffers released");
+    opencle::counter &migrations =
+        opencle::metrics::get_counter("opencle_buffer_migrations_total", "Buffers moved between devices of a context");
+
+    void record_upload(size_t bytes)
+    {
+        upload_bytes.add(bytes);
+        uploads.add();
+    }
+
+    void record_download(size_t bytes)
+    {
+        download_bytes.add(bytes);
+        downloads.add();
+    }
+};
+
+int __get_numa_node(opencle::device_impl const *dev)
+{
+    return dev ? dev->get_numa_node() : -1;
+}
+
+memory_metrics &__get_metrics()
+{
+    static memory_metrics m;
+    return m;
+}
+} // namespace
 
 namespace opencle
 {
 global_ptr_impl::global_ptr_impl(size_t size, bool read_only)
     : valid_{true}, size_{size}, read_only_{read_only}, host_ptr_{nullptr}, deleter_{nullptr}, device_ptr_{nullptr},
-      on_device_{nullptr}
+      on_device_{nullptr}, write_event_{nullptr}, read_event_num_{0}, resident_valid_{true}, resident_device_{nullptr},
+      resident_on_host_{false}
 {
     logger("global_ptr_impl(size_t, bool), create " << this);
     if (size == 0)
@@ -21,8 +67,9 @@ global_ptr_impl::global_ptr_impl(size_t size, bool read_only)
 }
 
 global_ptr_impl::global_ptr_impl(void *ptr, size_t size, Deleter deleter, bool read_only)
-    : valid_{true}, size_{size}, read_only_{read_only}, host_ptr_{ptr}, deleter_{deleter}, device_ptr_{nullptr}, on_device_{
-                                                                                                                     nullptr}
+    : valid_{true}, size_{size}, read_only_{read_only}, host_ptr_{ptr}, deleter_{deleter}, device_ptr_{nullptr},
+      on_device_{nullptr}, write_event_{nullptr}, read_event_num_{0}, resident_valid_{true}, resident_device_{nullptr},
+      resident_on_host_{true}
 {
     logger("global_ptr_impl(void *, size_t, Deleter, bool), create" << this);
     if (size == 0)
@@ -51,6 +98,9 @@ global_ptr_impl::global_ptr_impl(void *ptr, size_t size, Deleter deleter, bool r
 global_ptr_impl::~global_ptr_impl()
 {
     logger("~global_ptr_impl, destory " << this);
+    // a pending upload may still read the host memory
+    clear_events();
+
     if (host_ptr_ && deleter_)
     {
         deleter_(host_ptr_);
@@ -61,6 +111,7 @@ global_ptr_impl::~global_ptr_impl()
     {
         clReleaseMemObject(device_ptr_);
         logger("Release device pointer " << device_ptr_);
+        __get_metrics().frees.add();
     }
 }
 
@@ -72,13 +123,168 @@ global_ptr_impl::~global_ptr_impl()
 //     return *this;
 // }
 
+void global_ptr_impl::clear_events()
+{
+    logger("clear_events()");
+    if (write_event_)
+    {
+        clWaitForEvents(1, &write_event_);
+        clReleaseEvent(write_event_);
+        write_event_ = nullptr;
+    }
+    if (read_event_num_ > 0)
+    {
+        clWaitForEvents(read_event_num_, read_events_);
+        for (size_t i = 0; i < read_event_num_; ++i)
+        {
+            clReleaseEvent(read_events_[i]);
+        }
+        read_event_num_ = 0;
+    }
+}
+
+size_t global_ptr_impl::get_wait_list(bool is_write, cl_event wait_list[]) const
+{
+    size_t wait_num = 0;
+    if (write_event_)
+    {
+        wait_list[wait_num++] = write_event_;
+    }
+    if (is_write)
+    {
+        for (size_t i = 0; i < read_event_num_; ++i)
+        {
+            wait_list[wait_num++] = read_events_[i];
+        }
+    }
+    return wait_num;
+}
+
+void global_ptr_impl::set_event(cl_event event, bool is_write)
+{
+    logger("set_event(cl_event, bool)");
+    clRetainEvent(event);
+    if (is_write)
+    {
+        // the new writer has waited for all of them
+        if (write_event_)
+        {
+            clReleaseEvent(write_event_);
+        }
+        for (size_t i = 0; i < read_event_num_; ++i)
+        {
+            clReleaseEvent(read_events_[i]);
+        }
+        read_event_num_ = 0;
+        write_event_ = event;
+    }
+    else
+    {
+        if (read_event_num_ == max_read_event_num)
+        {
+            clWaitForEvents(1, &read_events_[0]);
+            clReleaseEvent(read_events_[0]);
+            for (size_t i = 1; i < read_event_num_; ++i)
+            {
+                read_events_[i - 1] = read_events_[i];
+            }
+            --read_event_num_;
+        }
+        read_events_[read_event_num_++] = event;
+    }
+}
+
+bool global_ptr_impl::is_read_only() const
+{
+    return read_only_;
+}
+
+cl_int global_ptr_impl::download(void *dst) const
+{
+    logger("download(void *) const");
+    cl_event wait_list[max_wait_event_num];
+    cl_uint wait_num = get_wait_list(false, wait_list);
+    cl_event event;
+    cl_int status = clEnqueueReadBuffer(on_device_->get_download_queue(), device_ptr_, CL_TRUE, 0, size_, dst, wait_num,
+                                        wait_list, &event);
+    on_device_->report_status(status);
+    if (status == CL_SUCCESS)
+    {
+        profiler::record_transfer(on_device_, transfer_direction::DOWNLOAD, size_, event);
+        clReleaseEvent(event);
+        __get_metrics().record_download(size_);
+    }
+    return status;
+}
+
+void global_ptr_impl::migrate(device_impl const *dev)
+{
+    logger("migrate(device_impl const *)");
+    cl_event wait_list[max_wait_event_num];
+    cl_uint wait_num = get_wait_list(true, wait_list);
+    cl_command_queue queue = dev->get_upload_queue();
+    cl_event event;
+    cl_int status = clEnqueueMigrateMemObjects(queue, 1, &device_ptr_, 0, wait_num, wait_list, &event);
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot migrate memory buffer!"};
+    }
+    // events of one context are valid on every queue of it
+    set_event(event, true);
+    __get_metrics().migrations.add();
+    clFlush(queue);
+    clReleaseEvent(event);
+    logger("Migrate memory " << device_ptr_ << " from device " << *on_device_ << " to device " << *dev << "!");
+    on_device_ = dev;
+}
+
+void global_ptr_impl::recover()
+{
+    logger("recover()");
+    // a read only buffer uses the host memory, which is still the content
+    if (!read_only_)
+    {
+        bool has_host_copy = host_ptr_;
+        if (!has_host_copy)
+        {
+            host_ptr_ = host_allocator::allocate(size_, -1);
+            deleter_ = [](void const *ptr) { delete[] static_cast<char const *>(ptr); };
+        }
+        if (download(host_ptr_) == CL_SUCCESS)
+        {
+            logger("Recover memory " << device_ptr_ << " on failed device " << *on_device_ << " to " << host_ptr_);
+        }
+        else if (has_host_copy)
+        {
+            // writes since the last synchronization are lost
+            logger_warn("Cannot read memory " << device_ptr_ << " on failed device " << *on_device_
+                                              << ", fall back to the last host copy");
+        }
+        else
+        {
+            logger_error("Cannot read memory " << device_ptr_ << " on failed device " << *on_device_);
+            deleter_(host_ptr_);
+            host_ptr_ = nullptr;
+            deleter_ = nullptr;
+            valid_ = false;
+        }
+    }
+
+    clear_events();
+    clReleaseMemObject(device_ptr_);
+    logger("Release memory " << device_ptr_ << " on device " << *on_device_ << "!");
+    __get_metrics().frees.add();
+    device_ptr_ = nullptr;
+    on_device_ = nullptr;
+}
+
 void *global_ptr_impl::get_read_write()
 {
     logger("get_read_write()");
     cl_int status;
     if (host_ptr_ && device_ptr_)
     {
-        status = clEnqueueReadBuffer(on_device_->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, host_ptr_, 0, NULL, NULL);
+        status = download(host_ptr_);
         if (status != CL_SUCCESS)
         {
             valid_ = false;
@@ -89,10 +295,10 @@ void *global_ptr_impl::get_read_write()
     }
     else if (device_ptr_)
     {
-        host_ptr_ = new char[size_];
+        host_ptr_ = host_allocator::allocate(size_, __get_numa_node(on_device_));
         deleter_ = [](void const *ptr) { delete[] static_cast<char const *>(ptr); };
         logger("Allocate memory " << host_ptr_ << " on host");
-        status = clEnqueueReadBuffer(on_device_->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, host_ptr_, 0, NULL, NULL);
+        status = download(host_ptr_);
         if (status != CL_SUCCESS)
         {
             valid_ = false;
@@ -109,9 +315,22 @@ void *global_ptr_impl::get_read_only()
     return host_ptr_;
 }
 
+void global_ptr_impl::publish_residency() const
+{
+    resident_valid_.store(valid_, std::memory_order_relaxed);
+    resident_device_.store(on_device_, std::memory_order_relaxed);
+    resident_on_host_.store(host_ptr_ != nullptr, std::memory_order_relaxed);
+}
+
 void *global_ptr_impl::get()
 {
     logger("get()");
+    residency_guard guard{this};
+    trace_span span{"get", "memory", on_device_};
+    if (on_device_ && !*on_device_)
+    {
+        recover();
+    }
     if (!valid_)
     {
         throw std::runtime_error{"Getting address of an invalid global_ptr"};
@@ -139,6 +358,7 @@ void *global_ptr_impl::release()
     deleter_ = nullptr;
     this->~global_ptr_impl();
     valid_ = false;
+    publish_residency();
     return temp;
 }
 
@@ -149,16 +369,17 @@ std::unique_ptr<global_ptr_impl> global_ptr_impl::clone() const
     {
         throw std::runtime_error{"Cannot clone an invalid global_ptr"};
     }
+    residency_guard guard{this};
 
     cl_int status;
 
-    void *new_ptr = new char[size_];
+    void *new_ptr = host_allocator::allocate(size_, __get_numa_node(on_device_));
     Deleter new_deleter = [](void const *ptr) { delete[] static_cast<char const *>(ptr); };
     logger("Allocate memory " << new_ptr << " on host");
 
     if (on_device_ && device_ptr_)
     {
-        status = clEnqueueReadBuffer(on_device_->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, new_ptr, 0, NULL, NULL);
+        status = download(new_ptr);
         if (status != CL_SUCCESS)
         {
             valid_ = false;
@@ -177,6 +398,7 @@ std::unique_ptr<global_ptr_impl> global_ptr_impl::clone() const
     }
     else
     {
+        new_deleter(new_ptr);
         return std::make_unique<global_ptr_impl>(size_);
     }
     return {};
@@ -200,6 +422,47 @@ bool global_ptr_impl::is_allocated() const
     return host_ptr_;
 }
 
+void *global_ptr_impl::detach()
+{
+    logger("detach()");
+    residency_guard guard{this};
+    if (on_device_ && !*on_device_)
+    {
+        recover();
+    }
+    if (!valid_)
+    {
+        throw std::runtime_error{"Detach an invalid global_ptr"};
+    }
+
+    if (!host_ptr_)
+    {
+        host_ptr_ = host_allocator::allocate(size_, __get_numa_node(on_device_));
+        deleter_ = [](void const *ptr) { delete[] static_cast<char const *>(ptr); };
+        logger("Allocate memory " << host_ptr_ << " on host");
+    }
+    if (device_ptr_)
+    {
+        if (!read_only_)
+        {
+            cl_int status = download(host_ptr_);
+            if (status != CL_SUCCESS)
+            {
+                valid_ = false;
+                throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
+            }
+            logger("Synchronize memory " << device_ptr_ << " on " << *on_device_ << " to " << host_ptr_ << " on host");
+        }
+        clear_events();
+        clReleaseMemObject(device_ptr_);
+        logger("Release memory " << device_ptr_ << " on device " << *on_device_ << "!");
+        __get_metrics().frees.add();
+        device_ptr_ = nullptr;
+        on_device_ = nullptr;
+    }
+    return host_ptr_;
+}
+
 cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
 {
     logger("to_device_read_write(device_impl const *)");
@@ -208,18 +471,39 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
     {
         if (on_device_ == dev)
         {
-            status = clEnqueueWriteBuffer(dev->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, host_ptr_, 0, NULL, NULL);
+            // the upload must not overtake kernels still using the buffer
+            cl_event wait_list[max_wait_event_num];
+            cl_uint wait_num = get_wait_list(true, wait_list);
+            cl_command_queue queue = dev->get_upload_queue();
+            cl_event event;
+            status = clEnqueueWriteBuffer(queue, device_ptr_, CL_FALSE, 0, size_, host_ptr_, wait_num, wait_list, &event);
             if (status != CL_SUCCESS)
             {
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
+            set_event(event, true);
+            on_device_->track_transfer(size_, event);
+            profiler::record_transfer(on_device_, transfer_direction::UPLOAD, size_, event);
+            __get_metrics().record_upload(size_);
+            // commands on other queues may wait for the upload
+            clFlush(queue);
+            clReleaseEvent(event);
             logger("Synchronize memory " << host_ptr_ << " to device " << *on_device_ << "!");
         }
+        else if (on_device_ && on_device_->get_context() == dev->get_context())
+        {
+            // the host copy is synchronized as below, but the buffer is kept
+            get();
+            migrate(dev);
+        }
         else if (on_device_)
         {
             get();
+            // events belong to the old context
+            clear_events();
             clReleaseMemObject(device_ptr_);
             logger("Release memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().frees.add();
 
             on_device_ = dev;
             device_ptr_ = clCreateBuffer(on_device_->get_context(), CL_MEM_READ_WRITE, size_, NULL, &status);
@@ -228,13 +512,21 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
 
-            status =
-                clEnqueueWriteBuffer(on_device_->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, host_ptr_, 0, NULL, NULL);
+            cl_command_queue queue = on_device_->get_upload_queue();
+            cl_event event;
+            status = clEnqueueWriteBuffer(queue, device_ptr_, CL_FALSE, 0, size_, host_ptr_, 0, NULL, &event);
             if (status != CL_SUCCESS)
             {
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
+            set_event(event, true);
+            on_device_->track_transfer(size_, event);
+            profiler::record_transfer(on_device_, transfer_direction::UPLOAD, size_, event);
+            __get_metrics().record_upload(size_);
+            clFlush(queue);
+            clReleaseEvent(event);
             logger("Synchronize memory " << host_ptr_ << " to device " << *on_device_ << "!");
         }
         else
@@ -246,13 +538,21 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
 
-            status =
-                clEnqueueWriteBuffer(on_device_->get_command_queue(), device_ptr_, CL_TRUE, 0, size_, host_ptr_, 0, NULL, NULL);
+            cl_command_queue queue = on_device_->get_upload_queue();
+            cl_event event;
+            status = clEnqueueWriteBuffer(queue, device_ptr_, CL_FALSE, 0, size_, host_ptr_, 0, NULL, &event);
             if (status != CL_SUCCESS)
             {
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
+            set_event(event, true);
+            on_device_->track_transfer(size_, event);
+            profiler::record_transfer(on_device_, transfer_direction::UPLOAD, size_, event);
+            __get_metrics().record_upload(size_);
+            clFlush(queue);
+            clReleaseEvent(event);
             logger("Synchronize memory " << host_ptr_ << " to device " << *on_device_ << "!");
         }
     }
@@ -261,10 +561,17 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
         if (on_device_ == dev)
         {
         }
+        else if (on_device_ && on_device_->get_context() == dev->get_context())
+        {
+            // the content lives only on the device, moving keeps it
+            migrate(dev);
+        }
         else if (on_device_)
         {
+            clear_events();
             clReleaseMemObject(device_ptr_);
             logger("Release memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().frees.add();
 
             on_device_ = dev;
             device_ptr_ = clCreateBuffer(on_device_->get_context(), CL_MEM_READ_WRITE, size_, NULL, &status);
@@ -273,6 +580,7 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot create memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
         }
         else
         {
@@ -283,6 +591,7 @@ cl_mem global_ptr_impl::to_device_read_write(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot create memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
         }
     }
     return device_ptr_;
@@ -297,10 +606,16 @@ cl_mem global_ptr_impl::to_device_read_only(device_impl const *dev)
         if (on_device_ == dev)
         {
         }
+        else if (on_device_ && on_device_->get_context() == dev->get_context())
+        {
+            migrate(dev);
+        }
         else if (on_device_)
         {
+            clear_events();
             clReleaseMemObject(device_ptr_);
             logger("Release memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().frees.add();
 
             on_device_ = dev;
             device_ptr_ =
@@ -310,6 +625,7 @@ cl_mem global_ptr_impl::to_device_read_only(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
         }
         else
         {
@@ -321,6 +637,7 @@ cl_mem global_ptr_impl::to_device_read_only(device_impl const *dev)
                 throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
             }
             logger("Create memory " << device_ptr_ << " on device " << *on_device_ << "!");
+            __get_metrics().allocations.add();
         }
     }
     else
@@ -330,8 +647,41 @@ cl_mem global_ptr_impl::to_device_read_only(device_impl const *dev)
     return device_ptr_;
 }
 
+double global_ptr_impl::get_transfer_time(device_impl const *dev) const
+{
+    logger("get_transfer_time(device_impl const *) const");
+    // a snapshot, the same cases as to_device_read_write / to_device_read_only
+    device_impl const *on_device = resident_device_.load(std::memory_order_relaxed);
+    if (!resident_valid_.load(std::memory_order_relaxed) || (on_device && !*on_device))
+    {
+        return 0;
+    }
+    else if (read_only_)
+    {
+        return on_device == dev ? 0 : dev->get_upload_time(size_);
+    }
+    else if (resident_on_host_.load(std::memory_order_relaxed))
+    {
+        bool is_dirty = on_device && on_device != dev;
+        return (is_dirty ? on_device->get_download_time(size_) : 0) + dev->get_upload_time(size_);
+    }
+    else if (on_device && on_device != dev)
+    {
+        // a migration within the context, counted like an upload so the
+        // contexts of idle devices need not be created to compare them
+        return dev->get_upload_time(size_);
+    }
+    return 0;
+}
+
 cl_mem global_ptr_impl::to_device(device_impl const *dev)
 {
+    trace_span span{"to_device", "memory", dev};
+    residency_guard guard{this};
+    if (on_device_ && !*on_device_)
+    {
+        recover();
+    }
     if (!valid_)
     {
         throw std::runtime_error{"Move invalid global_ptr to device"};
@@ -1,8 +1,7 @@
-#define NDEBUG
-
 #pragma once
 
 #include <CL/cl.h>
+#include <atomic>
 #include <functional>
 #include <memory>
 
@@ -16,6 +15,11 @@ class device_impl;
 
 class global_ptr_impl final
 {
+public:
+    // readers tracked since the last write, the oldest one is waited for when full
+    static constexpr size_t max_read_event_num = 7;
+    static constexpr size_t max_wait_event_num = max_read_event_num + 1;
+
 private:
     using Deleter = std::function<void(void const *)>;
 
@@ -28,6 +32,41 @@ private:
 
     cl_mem device_ptr_;
     device_impl const *on_device_;
+
+    cl_event write_event_;
+    cl_event read_events_[max_read_event_num];
+    size_t read_event_num_;
+
+    // copy of valid_ / on_device_ / host_ptr_ for get_transfer_time, which
+    // the scheduler calls while a task that uses the buffer moves it
+    mutable std::atomic<bool> resident_valid_;
+    mutable std::atomic<device_impl const *> resident_device_;
+    mutable std::atomic<bool> resident_on_host_;
+
+    void publish_residency() const;
+
+    /** Publishes the residency when an operation that moves the buffer
+     * returns or throws. */
+    struct residency_guard
+    {
+        global_ptr_impl const *self;
+        ~residency_guard()
+        {
+            self->publish_residency();
+        }
+    };
+
+    void clear_events();
+    cl_int download(void *dst) const;
+
+    /** Move the buffer to another device of the same context, keeping its
+     * content and events. */
+    void migrate(device_impl const *dev);
+
+    /** The device of the buffer failed: save what can be read back to the
+     * host and drop the buffer, so the next to_device starts over on a
+     * healthy device. */
+    void recover();
     
     void *get_read_write();
     void *get_read_only();
@@ -55,6 +94,26 @@ public:
     size_t size() const;
     bool is_allocated() const;
 
+    /** Make the host memory the only copy, synchronize it from the device
+     * (allocating host memory if there is none) and release the device
+     * buffer. Used when the host memory is written behind this object. */
+    void *detach();
+
     cl_mem to_device(device_impl const *dev);
+
+    /** Seconds of copies to_device(dev) would do now: a host copy is
+     * uploaded again, a writable buffer on another device is downloaded
+     * first, a buffer only on another device is migrated. Safe to call
+     * while another thread uses the buffer, it then sees the state before
+     * or after that use. */
+    double get_transfer_time(device_impl const *dev) const;
+
+    /** Commands on the device buffer are ordered only by events, so that
+     * out-of-order queues and several queues may overlap independent work.
+     * A reader waits for the last writer, a writer waits for every command,
+     * 'wait_list' needs room for max_wait_event_num events. */
+    size_t get_wait_list(bool is_write, cl_event wait_list[]) const;
+    void set_event(cl_event event, bool is_write);
+    bool is_read_only() const;
 };
 } // namespace opencle
\ No newline at end of file
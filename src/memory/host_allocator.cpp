@@ -0,0 +1,119 @@
+#include "host_allocator.hpp"
+
+#include <cstdint>
+#include <fstream>
+#include <linux/mempolicy.h>
+#include <stdexcept>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "../util/logger/logger.hpp"
+
+namespace
+{
+constexpr size_t max_node_num = 64;
+
+// parses a node list such as "0-3,5" from sysfs
+unsigned long __get_online_mask()
+{
+    std::ifstream in{"/sys/devices/system/node/online"};
+    std::string list;
+    unsigned long mask = 0;
+    if (!std::getline(in, list))
+    {
+        return 1;
+    }
+
+    size_t pos = 0;
+    while (pos < list.size())
+    {
+        size_t end = list.find(',', pos);
+        std::string range = list.substr(pos, end == std::string::npos ? std::string::npos : end - pos);
+        size_t dash = range.find('-');
+        try
+        {
+            unsigned long first = std::stoul(range.substr(0, dash));
+            unsigned long last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (unsigned long node = first; node <= last && node < max_node_num; ++node)
+            {
+                mask |= 1ul << node;
+            }
+        }
+        catch (std::exception const &)
+        {
+            return 1;
+        }
+        pos = end == std::string::npos ? list.size() : end + 1;
+    }
+    return mask ? mask : 1;
+}
+
+unsigned long __get_cached_online_mask()
+{
+    static unsigned long const mask = __get_online_mask();
+    return mask;
+}
+
+void __bind(char *ptr, size_t size, int mode, unsigned long mask)
+{
+    // only whole pages can be bound
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(ptr) + page - 1) / page * page;
+    uintptr_t end = (reinterpret_cast<uintptr_t>(ptr) + size) / page * page;
+    if (end <= begin)
+    {
+        return;
+    }
+    // a failing mbind only loses the placement
+    if (syscall(SYS_mbind, begin, end - begin, mode, &mask, max_node_num, 0) != 0)
+    {
+        logger_debug("Cannot bind " << end - begin << " bytes at " << ptr << " to node mask " << mask);
+    }
+}
+} // namespace
+
+namespace opencle
+{
+std::atomic<size_t> host_allocator::interleave_threshold_ = 0;
+
+int host_allocator::get_node_num()
+{
+    return __builtin_popcountl(__get_cached_online_mask());
+}
+
+char *host_allocator::allocate(size_t size, int numa_node)
+{
+    logger("allocate(size_t, int)");
+    char *ptr = new char[size];
+    if (size < min_placed_size || get_node_num() < 2)
+    {
+        return ptr;
+    }
+
+    unsigned long online = __get_cached_online_mask();
+    size_t threshold = interleave_threshold_.load(std::memory_order_relaxed);
+    if (threshold > 0 && size >= threshold)
+    {
+        __bind(ptr, size, MPOL_INTERLEAVE, online);
+        logger("Interleave " << size << " bytes at " << static_cast<void *>(ptr));
+    }
+    else if (numa_node >= 0 && static_cast<size_t>(numa_node) < max_node_num && (online & (1ul << numa_node)))
+    {
+        __bind(ptr, size, MPOL_PREFERRED, 1ul << numa_node);
+        logger("Place " << size << " bytes at " << static_cast<void *>(ptr) << " on node " << numa_node);
+    }
+    return ptr;
+}
+
+void host_allocator::set_interleave_threshold(size_t size)
+{
+    logger("set_interleave_threshold(size_t)");
+    interleave_threshold_ = size;
+}
+
+size_t host_allocator::get_interleave_threshold()
+{
+    return interleave_threshold_;
+}
+} // namespace opencle
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+class host_allocator;
+
+/** Host memory placed on a NUMA node, so the staging copy of a buffer sits
+ * next to the device that reads it instead of wherever the calling thread
+ * runs. Memory comes from new[] and is released with delete[] as before, so
+ * it can still be handed to the user; the whole pages inside it are bound
+ * with mbind before they are first touched. */
+class host_allocator final
+{
+public:
+    // smaller blocks share pages with other allocations, they are not bound
+    static constexpr size_t min_placed_size = 1 << 16;
+
+private:
+    static std::atomic<size_t> interleave_threshold_;
+
+public:
+    host_allocator() = delete;
+
+    /** Number of online NUMA nodes, 1 on machines without NUMA. */
+    static int get_node_num();
+
+    /** Allocate 'size' bytes preferably on 'numa_node', -1 means no
+     * preference. Placement is best effort: pages the allocator touched
+     * already stay where they are. */
+    static char *allocate(size_t size, int numa_node);
+
+    /** Buffers of at least 'size' bytes are interleaved over every node
+     * instead, so one huge buffer does not fill up a single node; 0, the
+     * default, turns interleaving off. */
+    static void set_interleave_threshold(size_t size);
+    static size_t get_interleave_threshold();
+};
+} // namespace opencle
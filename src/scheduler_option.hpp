@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+
+namespace opencle {
+
+/** What AMP::exec does when a limit of scheduler_option is reached,
+ * AMP::try_exec never waits and returns false instead. */
+enum class admission_policy {
+    // wait until enough admitted tasks have finished
+    BLOCK,
+
+    // throw std::runtime_error, the caller decides to retry or drop
+    REJECT
+};
+
+/** How the scheduler behind AMP runs and admits tasks, taken by the AMP
+ * that starts it. Limits of 0 mean no limit. */
+struct scheduler_option {
+    // threads per device that only run task_priority::HIGH
+    size_t reserved_num = 1;
+
+    // tasks admitted and not finished
+    size_t max_pending_num = 4096;
+
+    // bytes of the buffers those tasks declared with Task::uses, which stay
+    // alive with their host copies until the tasks ran; a single task
+    // larger than the limit is still admitted once nothing else is pending
+    size_t max_pending_bytes = 0;
+
+    admission_policy policy = admission_policy::BLOCK;
+};
+
+} // namespace opencle
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <cstddef>
+#include <type_traits>
+
+#include "../../memory/global_ptr.hpp"
+#include "../task_impl.hpp"
+#include "argument_local.hpp"
+
+namespace opencle
+{
+template <typename T, typename X = void>
+struct argument_binder;
+
+/** Scalar argument, bound straight from the caller's stack frame. */
+template <typename T>
+struct argument_binder<T, std::enable_if_t<std::is_pod_v<T>>>
+{
+    using param_type = T const &;
+
+    static void bind(task_impl &impl, kernel_lease const &kernel, size_t index, T const &value)
+    {
+        impl.set_arg(kernel, index, sizeof(T), &value);
+    }
+
+    static void wait(T const &, cl_event[], cl_uint &)
+    {
+    }
+
+    static void signal(T const &, cl_event)
+    {
+    }
+};
+
+/** Buffer argument, the global_ptr is moved to the task's device first. */
+template <typename T>
+struct argument_binder<global_ptr<T[]>>
+{
+    using param_type = global_ptr<T[]> &;
+
+    static void bind(task_impl &impl, kernel_lease const &kernel, size_t index, global_ptr<T[]> &ptr)
+    {
+        // residency is bookkeeping, even a global_ptr of const elements moves
+        cl_mem mem = const_cast<global_ptr_impl &>(*ptr.impl_).to_device(impl.get_device());
+        impl.set_arg(kernel, index, sizeof(cl_mem), &mem);
+    }
+
+    /** Append the events the launch has to wait for, a buffer that is not
+     * read-only is taken as written by the kernel. */
+    static void wait(global_ptr<T[]> &ptr, cl_event wait_list[], cl_uint &wait_num)
+    {
+        global_ptr_impl const &impl = *ptr.impl_;
+        wait_num = wait_num + impl.get_wait_list(!impl.is_read_only(), wait_list + wait_num);
+    }
+
+    static void signal(global_ptr<T[]> &ptr, cl_event done)
+    {
+        global_ptr_impl &impl = const_cast<global_ptr_impl &>(*ptr.impl_);
+        impl.set_event(done, !impl.is_read_only());
+    }
+};
+
+/** __local argument, only the size is passed. */
+template <typename T>
+struct argument_binder<local_memory<T>>
+{
+    using param_type = local_memory<T> const &;
+
+    static void bind(task_impl &impl, kernel_lease const &kernel, size_t index, local_memory<T> const &mem)
+    {
+        impl.set_arg(kernel, index, mem.byte_size(), nullptr);
+    }
+
+    static void wait(local_memory<T> const &, cl_event[], cl_uint &)
+    {
+    }
+
+    static void signal(local_memory<T> const &, cl_event)
+    {
+    }
+};
+
+/** Upper bound of the events a launch with 'Args' waits for. */
+template <typename... Args>
+constexpr size_t max_wait_event_num_v = sizeof...(Args) * global_ptr_impl::max_wait_event_num;
+
+template <typename T>
+using argument_param_t = typename argument_binder<T>::param_type;
+} // namespace opencle
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+
+namespace opencle
+{
+template <typename T>
+class local_memory;
+
+/** Placeholder of a __local kernel argument, only the number of elements
+ * is passed to OpenCL. */
+template <typename T>
+class local_memory final
+{
+    static_assert(std::is_pod_v<T>, "local_memory only holds POD type");
+
+private:
+    size_t size_;
+
+public:
+    explicit local_memory(size_t size)
+        : size_{size}
+    {
+    }
+
+    size_t size() const
+    {
+        return size_;
+    }
+
+    size_t byte_size() const
+    {
+        return size_ * sizeof(T);
+    }
+};
+} // namespace opencle
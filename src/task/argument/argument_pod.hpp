@@ -10,7 +10,7 @@ class argument_pod;
 template <typename T>
 class argument_pod<std::enable_if_t<std::is_pod_v<T>, T>> : public argument_base
 {
-    std::unique_ptr<T> value_;
+    T value_;
 
 public:
     argument_pod(T const &value)
@@ -19,7 +19,7 @@ public:
         logger("argument_pod(T const &), create " << this);
     }
     argument_pod(argument_pod &&rhs)
-        : argument_base{std::move(rhs)}, value_{std::move(rhs.value_)}
+        : argument_base{std::move(rhs)}, value_{rhs.value_}
     {
         logger("argument_pod(argument_pod &&), create " << this);
     }
@@ -32,7 +32,7 @@ public:
     {
         logger("operator=(argument &&), " << this << " from " << &rhs);
         argument_base::operator=(std::move(rhs));
-        value_ = std::move(rhs.value_);
+        value_ = rhs.value_;
     }
 
     void init(device_impl &impl) override
@@ -47,7 +47,7 @@ public:
     void *get_pointer() override
     {
         logger("get_pointer()");
-        return value_.get();
+        return &value_;
     }
 };
 
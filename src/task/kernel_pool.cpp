@@ -0,0 +1,205 @@
+#include "kernel_pool.hpp"
+
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+#include "../util/logger/logger.hpp"
+
+namespace
+{
+// kernels created up front, enough for a few host threads without cloning
+constexpr size_t initial_kernel_num = 4;
+
+bool __is_version_at_least(std::string const &version, int major, int minor)
+{
+    // "OpenCL <major>.<minor> <vendor specific>"
+    int version_major = 0;
+    int version_minor = 0;
+    if (std::sscanf(version.c_str(), "OpenCL %d.%d", &version_major, &version_minor) != 2)
+    {
+        return false;
+    }
+    return version_major > major || (version_major == major && version_minor >= minor);
+}
+
+std::string __get_device_info(cl_device_id device, cl_device_info param)
+{
+    size_t size = 0;
+    if (clGetDeviceInfo(device, param, 0, NULL, &size) != CL_SUCCESS || size == 0)
+    {
+        return std::string{};
+    }
+    std::vector<char> value(size);
+    if (clGetDeviceInfo(device, param, size, value.data(), NULL) != CL_SUCCESS)
+    {
+        return std::string{};
+    }
+    return std::string{value.data()};
+}
+
+std::string __get_platform_info(cl_platform_id platform, cl_platform_info param)
+{
+    size_t size = 0;
+    if (clGetPlatformInfo(platform, param, 0, NULL, &size) != CL_SUCCESS || size == 0)
+    {
+        return std::string{};
+    }
+    std::vector<char> value(size);
+    if (clGetPlatformInfo(platform, param, size, value.data(), NULL) != CL_SUCCESS)
+    {
+        return std::string{};
+    }
+    return std::string{value.data()};
+}
+
+// clCloneKernel is an OpenCL 2.1 entry point, older platforms either do not
+// export it or dispatch it to nothing, so both the platform and every device
+// of the program have to be 2.1 or newer
+bool __is_clonable(cl_program program)
+{
+    cl_uint device_num = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(cl_uint), &device_num, NULL) != CL_SUCCESS ||
+        device_num == 0)
+    {
+        return false;
+    }
+    std::vector<cl_device_id> devices(device_num);
+    if (clGetProgramInfo(program, CL_PROGRAM_DEVICES, device_num * sizeof(cl_device_id), devices.data(), NULL) !=
+        CL_SUCCESS)
+    {
+        return false;
+    }
+
+    cl_platform_id platform;
+    if (clGetDeviceInfo(devices[0], CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &platform, NULL) != CL_SUCCESS ||
+        !__is_version_at_least(__get_platform_info(platform, CL_PLATFORM_VERSION), 2, 1))
+    {
+        return false;
+    }
+    for (auto const &device : devices)
+    {
+        if (!__is_version_at_least(__get_device_info(device, CL_DEVICE_VERSION), 2, 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+} // namespace
+
+namespace opencle
+{
+kernel_pool::kernel_pool(cl_program program, std::string const &kernel_name)
+    : program_{program}, kernel_name_{kernel_name}, prototype_{nullptr}, is_clonable_{false}, idle_mutex_{}, idle_{}, kernel_num_{0}
+{
+    logger("kernel_pool(cl_program, std::string const &), create " << this);
+    cl_int status;
+    prototype_ = clCreateKernel(program_, kernel_name_.c_str(), &status);
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot create kernel of " + kernel_name_};
+    }
+    clRetainProgram(program_);
+    is_clonable_ = __is_clonable(program_);
+    logger("Kernels of " << kernel_name_ << (is_clonable_ ? " are cloned" : " are created from the program"));
+    idle_.reserve(initial_kernel_num);
+    for (size_t i = 0; i < initial_kernel_num; ++i)
+    {
+        idle_.push_back(create());
+    }
+}
+
+kernel_pool::~kernel_pool()
+{
+    logger("~kernel_pool(), destory " << this);
+    if (idle_.size() != kernel_num_)
+    {
+        logger("Destory kernel_pool with " << kernel_num_ - idle_.size() << " kernels checked out");
+    }
+    for (auto &kernel : idle_)
+    {
+        clReleaseKernel(kernel);
+    }
+    clReleaseKernel(prototype_);
+    clReleaseProgram(program_);
+}
+
+cl_kernel kernel_pool::create()
+{
+    logger("create()");
+    cl_int status;
+    cl_kernel kernel = nullptr;
+    if (is_clonable_)
+    {
+        kernel = clCloneKernel(prototype_, &status);
+        if (status != CL_SUCCESS)
+        {
+            kernel = nullptr;
+        }
+    }
+    if (!kernel)
+    {
+        kernel = clCreateKernel(program_, kernel_name_.c_str(), &status);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot create kernel of " + kernel_name_};
+        }
+    }
+    ++kernel_num_;
+    logger("Create kernel " << kernel << ", " << kernel_num_ << " kernels in pool " << this);
+
+    return kernel;
+}
+
+cl_kernel kernel_pool::acquire()
+{
+    std::lock_guard<std::mutex> lock{idle_mutex_};
+    if (idle_.empty())
+    {
+        cl_kernel kernel = create();
+        // release() never grows idle_ past the number of kernels
+        idle_.reserve(kernel_num_);
+        return kernel;
+    }
+    cl_kernel kernel = idle_.back();
+    idle_.pop_back();
+    return kernel;
+}
+
+void kernel_pool::release(cl_kernel kernel)
+{
+    std::lock_guard<std::mutex> lock{idle_mutex_};
+    idle_.push_back(kernel);
+}
+
+size_t kernel_pool::size() const
+{
+    return kernel_num_;
+}
+
+kernel_lease::kernel_lease(kernel_pool &pool)
+    : pool_{&pool}, kernel_{pool.acquire()}
+{
+}
+
+kernel_lease::kernel_lease(kernel_lease &&rhs)
+    : pool_{rhs.pool_}, kernel_{rhs.kernel_}
+{
+    rhs.pool_ = nullptr;
+    rhs.kernel_ = nullptr;
+}
+
+kernel_lease::~kernel_lease()
+{
+    if (pool_)
+    {
+        pool_->release(kernel_);
+    }
+}
+
+cl_kernel kernel_lease::get() const
+{
+    return kernel_;
+}
+} // namespace opencle
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+class kernel_pool;
+class kernel_lease;
+
+/** A cl_kernel carries its argument state, so every concurrent launch of
+ * the same kernel needs its own instance. The pool hands out idle kernels
+ * and creates a new one (cloned from a never leased prototype, or with
+ * clCreateKernel before OpenCL 2.1) only when all of them are checked out. */
+class kernel_pool final
+{
+private:
+    cl_program program_;
+    std::string kernel_name_;
+    cl_kernel prototype_;
+    bool is_clonable_;
+
+    std::mutex idle_mutex_;
+    std::vector<cl_kernel> idle_;
+    std::atomic<size_t> kernel_num_;
+
+    cl_kernel create();
+
+public:
+    kernel_pool(cl_program program, std::string const &kernel_name);
+    kernel_pool(kernel_pool const &rhs) = delete;
+    kernel_pool(kernel_pool &&rhs) = delete;
+    ~kernel_pool();
+
+    kernel_pool &operator=(kernel_pool const &rhs) = delete;
+    kernel_pool &operator=(kernel_pool &&rhs) = delete;
+
+    cl_kernel acquire();
+    void release(cl_kernel kernel);
+    size_t size() const;
+};
+
+/** RAII checkout of a kernel from a kernel_pool. */
+class kernel_lease final
+{
+private:
+    kernel_pool *pool_;
+    cl_kernel kernel_;
+
+public:
+    kernel_lease(kernel_pool &pool);
+    kernel_lease(kernel_lease const &rhs) = delete;
+    kernel_lease(kernel_lease &&rhs);
+    ~kernel_lease();
+
+    kernel_lease &operator=(kernel_lease const &rhs) = delete;
+    kernel_lease &operator=(kernel_lease &&rhs) = delete;
+
+    cl_kernel get() const;
+};
+} // namespace opencle
@@ -0,0 +1,183 @@
+#include "program_cache.hpp"
+
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+
+#include "../device/device_impl.hpp"
+#include "../util/logger/logger.hpp"
+#include "../util/metrics/metrics.hpp"
+
+namespace
+{
+std::string __get_build_log(cl_program program, cl_device_id dev_id)
+{
+    size_t log_size;
+    if (clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, 0, NULL, &log_size) != CL_SUCCESS)
+    {
+        return {};
+    }
+    std::unique_ptr<char[]> log{new char[log_size + 1]};
+    if (clGetProgramBuildInfo(program, dev_id, CL_PROGRAM_BUILD_LOG, log_size, log.get(), NULL) != CL_SUCCESS)
+    {
+        return {};
+    }
+    log[log_size] = '\0';
+    return std::string{log.get()};
+}
+
+std::vector<cl_device_id> __get_context_devices(cl_context context)
+{
+    cl_uint device_num = 0;
+    if (clGetContextInfo(context, CL_CONTEXT_NUM_DEVICES, sizeof(cl_uint), &device_num, NULL) != CL_SUCCESS)
+    {
+        return {};
+    }
+    std::vector<cl_device_id> devices(device_num);
+    if (clGetContextInfo(context, CL_CONTEXT_DEVICES, device_num * sizeof(cl_device_id), devices.data(), NULL) !=
+        CL_SUCCESS)
+    {
+        return {};
+    }
+    return devices;
+}
+} // namespace
+
+namespace opencle
+{
+std::mutex program_cache::cache_mutex_ = std::mutex{};
+std::map<program_cache::Key, std::shared_future<program_cache::Program>> program_cache::cache_ =
+    std::map<program_cache::Key, std::shared_future<program_cache::Program>>{};
+
+cl_program program_cache::build(device_impl const *dev_impl, std::string const &source, std::string const &options,
+                               std::vector<cl_device_id> &built_for)
+{
+    logger("build(device_impl const *, std::string const &, std::string const &, std::vector<cl_device_id> &)");
+    static counter &builds = metrics::get_counter("opencle_program_builds_total", "Programs built by OpenCL");
+    static histogram &build_time =
+        metrics::get_histogram("opencle_program_build_microseconds", "Time spent in clBuildProgram");
+    auto start = std::chrono::steady_clock::now();
+    cl_int status;
+    char const *src = source.c_str();
+    cl_program program = clCreateProgramWithSource(dev_impl->get_context(), 1, &src, NULL, &status);
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot create program"};
+    }
+
+    cl_device_id dev_id = dev_impl->get_device_id();
+
+    // one build serves every device of a shared context, unless one of them
+    // cannot build the source
+    built_for = __get_context_devices(dev_impl->get_context());
+    status = CL_SUCCESS;
+    if (built_for.size() <= 1 || clBuildProgram(program, 0, NULL, options.c_str(), NULL, NULL) != CL_SUCCESS)
+    {
+        built_for.assign(1, dev_id);
+        status = clBuildProgram(program, 1, &dev_id, options.c_str(), NULL, NULL);
+    }
+    builds.add();
+    build_time.observe(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+    if (status != CL_SUCCESS)
+    {
+        std::string build_log = __get_build_log(program, dev_id);
+        clReleaseProgram(program);
+        throw std::runtime_error{"OpenCL runtime error: Cannot build program with options \"" + options + "\"\n" +
+                                 build_log};
+    }
+    logger_info("Build program " << program << " for " << built_for.size() << " devices with options " << options);
+
+    return program;
+}
+
+cl_program program_cache::get(device_impl const *dev_impl, std::string const &source, std::string const &options)
+{
+    logger("get(device_impl const *, std::string const &, std::string const &)");
+    Key key{dev_impl->get_context(), dev_impl->get_device_id(), source, options};
+    std::shared_future<Program> program;
+    std::promise<Program> promise;
+    bool is_builder = false;
+    {
+        std::lock_guard<std::mutex> lock{cache_mutex_};
+        auto it = cache_.find(key);
+        if (it == cache_.end())
+        {
+            program = promise.get_future().share();
+            cache_.emplace(key, program);
+            is_builder = true;
+        }
+        else
+        {
+            program = it->second;
+        }
+    }
+
+    if (is_builder)
+    {
+        std::vector<cl_device_id> built_for;
+        try
+        {
+            Program built{build(dev_impl, source, options, built_for), [](cl_program p) { clReleaseProgram(p); }};
+            {
+                std::lock_guard<std::mutex> lock{cache_mutex_};
+                for (cl_device_id other : built_for)
+                {
+                    if (other != dev_impl->get_device_id())
+                    {
+                        std::promise<Program> ready;
+                        ready.set_value(built);
+                        cache_.emplace(Key{dev_impl->get_context(), other, source, options}, ready.get_future().share());
+                    }
+                }
+            }
+            promise.set_value(built);
+        }
+        catch (...)
+        {
+            // the next request builds again, the waiting ones get the error
+            {
+                std::lock_guard<std::mutex> lock{cache_mutex_};
+                cache_.erase(key);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+    else
+    {
+        static counter &hits = metrics::get_counter("opencle_program_cache_hits_total", "Programs reused from the cache");
+        hits.add();
+    }
+
+    // 'program' keeps the shared program alive until it is retained
+    cl_program result = program.get().get();
+    logger("Use program " << result);
+    clRetainProgram(result);
+    return result;
+}
+
+void program_cache::evict(cl_context context, cl_device_id dev_id)
+{
+    logger("evict(cl_context, cl_device_id)");
+    std::lock_guard<std::mutex> lock{cache_mutex_};
+    for (auto it = cache_.begin(); it != cache_.end();)
+    {
+        if (std::get<0>(it->first) == context && std::get<1>(it->first) == dev_id)
+        {
+            it = cache_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void program_cache::clear()
+{
+    logger("clear()");
+    std::lock_guard<std::mutex> lock{cache_mutex_};
+    cache_.clear();
+}
+} // namespace opencle
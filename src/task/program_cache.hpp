@@ -0,0 +1,55 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+class program_cache;
+class device_impl;
+
+/** Built programs shared by every task with the same source and build
+ * options on the same device, so specialized variants are compiled once
+ * per distinct set of constants. Programs are built outside the lock, a
+ * second request for one being built waits for that build only. */
+class program_cache final
+{
+private:
+    using Key = std::tuple<cl_context, cl_device_id, std::string, std::string>;
+    // released when the last entry and the last waiter drop it
+    using Program = std::shared_ptr<std::remove_pointer_t<cl_program>>;
+
+    static std::mutex cache_mutex_;
+    static std::map<Key, std::shared_future<Program>> cache_;
+
+    /** Build for every device of the context when there are several,
+     * falling back to the requesting device alone if that fails. 'built_for'
+     * receives the devices the program was built for. */
+    static cl_program build(device_impl const *dev_impl, std::string const &source, std::string const &options,
+                            std::vector<cl_device_id> &built_for);
+
+public:
+    program_cache() = delete;
+
+    /** Return a retained program, the caller owns one reference. */
+    static cl_program get(device_impl const *dev_impl, std::string const &source, std::string const &options);
+
+    /** Release the cached programs of 'dev_id' in 'context', called when
+     * the device goes away, so a context created later at the same address
+     * never gets them. */
+    static void evict(cl_context context, cl_device_id dev_id);
+
+    /** Release every cached program, programs still used by a task stay
+     * alive until the task releases them. */
+    static void clear();
+};
+} // namespace opencle
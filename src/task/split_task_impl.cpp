@@ -0,0 +1,430 @@
+#include "split_task_impl.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "../device/device_impl.hpp"
+#include "../memory/global_ptr_impl.hpp"
+#include "../util/logger/logger.hpp"
+
+namespace
+{
+// weight of the latest run in the moving average of the throughput
+constexpr double throughput_smoothing = 0.5;
+
+void __release_buffers(std::vector<cl_mem> &buffers)
+{
+    for (auto &buffer : buffers)
+    {
+        if (buffer)
+        {
+            clReleaseMemObject(buffer);
+        }
+    }
+}
+
+void __release_events(std::vector<cl_event> &events)
+{
+    for (auto &event : events)
+    {
+        clReleaseEvent(event);
+    }
+    events.clear();
+}
+} // namespace
+
+namespace opencle
+{
+split_task_impl::partition_worker::partition_worker()
+{
+    thread = std::thread{[this]() {
+        std::unique_lock<std::mutex> lock{mutex};
+        while (true)
+        {
+            cv.wait(lock, [this]() { return job || is_stopped; });
+            if (!job)
+            {
+                return;
+            }
+            std::function<void()> next = std::move(job);
+            job = nullptr;
+            lock.unlock();
+            try
+            {
+                next();
+            }
+            catch (...)
+            {
+                error = std::current_exception();
+            }
+            lock.lock();
+            is_busy = false;
+            cv.notify_all();
+        }
+    }};
+}
+
+split_task_impl::partition_worker::~partition_worker()
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        is_stopped = true;
+    }
+    cv.notify_all();
+    thread.join();
+}
+
+void split_task_impl::partition_worker::post(std::function<void()> next)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex};
+        job = std::move(next);
+        is_busy = true;
+        error = nullptr;
+    }
+    cv.notify_all();
+}
+
+void split_task_impl::partition_worker::wait()
+{
+    std::unique_lock<std::mutex> lock{mutex};
+    cv.wait(lock, [this]() { return !is_busy; });
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+
+split_task_impl::split_task_impl(std::string const &source, std::string const &kernel_name)
+    : source_{source}, kernel_name_{kernel_name}, devices_{}, tasks_{}, workers_{}, args_{}, throughput_mutex_{},
+      throughput_{}
+{
+    logger("split_task_impl(std::string const &, std::string const &), create " << this);
+}
+
+split_task_impl::~split_task_impl()
+{
+    logger("~split_task_impl(), destory " << this);
+}
+
+void split_task_impl::compile(std::vector<device_impl *> const &devices)
+{
+    logger("compile(std::vector<device_impl *> const &)");
+    if (devices.empty())
+    {
+        throw std::runtime_error{"Split task needs at least one device"};
+    }
+
+    tasks_.clear();
+    devices_ = devices;
+    for (auto &dev_impl : devices_)
+    {
+        tasks_.push_back(std::make_unique<task_impl>(source_, kernel_name_));
+        tasks_.back()->compile(dev_impl);
+    }
+    // kept across exec, so a run only wakes threads up
+    workers_.resize(devices_.size() - 1);
+    for (auto &worker : workers_)
+    {
+        if (!worker)
+        {
+            worker = std::make_unique<partition_worker>();
+        }
+    }
+}
+
+split_task_impl::argument &split_task_impl::get_arg(size_t index)
+{
+    if (args_.size() <= index)
+    {
+        args_.resize(index + 1, argument{argument::kind::NONE, {}, 0, nullptr, 0, split_access::BROADCAST});
+    }
+    return args_[index];
+}
+
+void split_task_impl::set_arg(size_t index, size_t size, void const *value)
+{
+    logger("set_arg(size_t, size_t, void const *)");
+    argument &arg = get_arg(index);
+    arg.type = argument::kind::SCALAR;
+    arg.value.assign(static_cast<char const *>(value), static_cast<char const *>(value) + size);
+    arg.size = size;
+}
+
+void split_task_impl::set_arg_local(size_t index, size_t size)
+{
+    logger("set_arg_local(size_t, size_t)");
+    argument &arg = get_arg(index);
+    arg.type = argument::kind::LOCAL;
+    arg.size = size;
+}
+
+void split_task_impl::set_arg_buffer(size_t index, global_ptr_impl *buffer, split_access access, size_t slice_size)
+{
+    logger("set_arg_buffer(size_t, global_ptr_impl *, split_access, size_t)");
+    if (access != split_access::BROADCAST && slice_size == 0)
+    {
+        throw std::runtime_error{"Sliced argument needs the size of a slice"};
+    }
+    argument &arg = get_arg(index);
+    arg.type = argument::kind::BUFFER;
+    arg.buffer = buffer;
+    arg.size = buffer->size();
+    arg.slice_size = slice_size;
+    arg.access = access;
+}
+
+std::vector<double> split_task_impl::get_weights(split_weight weight)
+{
+    std::vector<double> weights;
+    if (weight == split_weight::THROUGHPUT)
+    {
+        std::lock_guard<std::mutex> lock{throughput_mutex_};
+        for (auto &dev_impl : devices_)
+        {
+            auto it = throughput_.find(dev_impl);
+            if (it == throughput_.end())
+            {
+                weights.clear();
+                break;
+            }
+            weights.push_back(it->second);
+        }
+    }
+    if (weights.empty())
+    {
+        for (auto &dev_impl : devices_)
+        {
+            weights.push_back(static_cast<double>(dev_impl->get_compute_unit_total()));
+        }
+    }
+    return weights;
+}
+
+void split_task_impl::run_partition(size_t device_index, size_t dim, size_t global_offset[], size_t global_size[],
+                                    size_t local_size[], launch_mode mode, std::vector<void *> const &host_ptrs)
+{
+    logger("run_partition(size_t, ...), on device " << device_index);
+    device_impl *dev_impl = devices_[device_index];
+    task_impl &task = *tasks_[device_index];
+    cl_command_queue upload_queue = dev_impl->get_upload_queue();
+    cl_command_queue download_queue = dev_impl->get_download_queue();
+
+    size_t begin = global_offset[0];
+    size_t end = global_offset[0] + global_size[0];
+
+    auto start = std::chrono::steady_clock::now();
+
+    cl_int status;
+    std::vector<cl_mem> buffers(args_.size(), nullptr);
+    std::vector<cl_event> write_events;
+    try
+    {
+        kernel_lease kernel = task.lease();
+        for (size_t i = 0; i < args_.size(); ++i)
+        {
+            argument const &arg = args_[i];
+            switch (arg.type)
+            {
+            case argument::kind::SCALAR:
+                task.set_arg(kernel, i, arg.size, arg.value.data());
+                break;
+            case argument::kind::LOCAL:
+                task.set_arg(kernel, i, arg.size, nullptr);
+                break;
+            case argument::kind::BUFFER:
+            {
+                // full sized, so the kernel indexes the buffer with the global id
+                buffers[i] = clCreateBuffer(dev_impl->get_context(), CL_MEM_READ_WRITE, arg.size, NULL, &status);
+                if (status != CL_SUCCESS)
+                {
+                    throw std::runtime_error{"OpenCL runtime error: Cannot create memory buffer!"};
+                }
+
+                size_t offset = arg.access == split_access::BROADCAST ? 0 : begin * arg.slice_size;
+                size_t size = arg.access == split_access::BROADCAST ? arg.size : (end - begin) * arg.slice_size;
+                if (offset + size > arg.size)
+                {
+                    throw std::out_of_range{"Sliced argument is smaller than the range"};
+                }
+                if (arg.access != split_access::SLICE_OUT)
+                {
+                    cl_event event;
+                    status = clEnqueueWriteBuffer(upload_queue, buffers[i], CL_FALSE, offset, size,
+                                                  static_cast<char *>(host_ptrs[i]) + offset, 0, NULL, &event);
+                    if (status != CL_SUCCESS)
+                    {
+                        throw std::runtime_error{"OpenCL runtime error: Cannot write memory buffer!"};
+                    }
+                    dev_impl->track_transfer(size, event);
+                    write_events.push_back(event);
+                }
+                task.set_arg(kernel, i, sizeof(cl_mem), &buffers[i]);
+                break;
+            }
+            default:
+                throw std::runtime_error{"Argument " + std::to_string(i) + " of split task is not set"};
+            }
+        }
+
+        // the kernel runs on a compute queue, it waits for the writes by their events
+        clFlush(upload_queue);
+        cl_event done = nullptr;
+        task.exec(kernel, dim, global_offset, global_size, local_size, mode, write_events.size(),
+                  write_events.data(), &done);
+        __release_events(write_events);
+
+        for (size_t i = 0; i < args_.size(); ++i)
+        {
+            argument const &arg = args_[i];
+            if (arg.type == argument::kind::BUFFER &&
+                (arg.access == split_access::SLICE_OUT || arg.access == split_access::SLICE_IN_OUT))
+            {
+                size_t offset = begin * arg.slice_size;
+                size_t size = (end - begin) * arg.slice_size;
+                status = clEnqueueReadBuffer(download_queue, buffers[i], CL_TRUE, offset, size,
+                                             static_cast<char *>(host_ptrs[i]) + offset, done ? 1 : 0,
+                                             done ? &done : NULL, NULL);
+                if (status != CL_SUCCESS)
+                {
+                    if (done)
+                    {
+                        clReleaseEvent(done);
+                    }
+                    throw std::runtime_error{"OpenCL runtime error: Cannot read memory buffer!"};
+                }
+            }
+        }
+        if (done)
+        {
+            clReleaseEvent(done);
+        }
+    }
+    catch (...)
+    {
+        dev_impl->finish();
+        __release_events(write_events);
+        __release_buffers(buffers);
+        throw;
+    }
+    __release_buffers(buffers);
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    size_t item_num = 1;
+    for (size_t i = 0; i < dim; ++i)
+    {
+        item_num = item_num * global_size[i];
+    }
+
+    std::lock_guard<std::mutex> lock{throughput_mutex_};
+    double throughput = item_num / std::max(elapsed.count(), 1e-9);
+    auto it = throughput_.find(dev_impl);
+    if (it == throughput_.end())
+    {
+        throughput_[dev_impl] = throughput;
+    }
+    else
+    {
+        it->second = throughput_smoothing * throughput + (1 - throughput_smoothing) * it->second;
+    }
+    logger("Partition [" << begin << ", " << end << ") takes " << elapsed.count() << "s");
+}
+
+void split_task_impl::exec(size_t dim, size_t global_size[], size_t local_size[], split_weight weight,
+                           launch_mode mode)
+{
+    logger("exec(size_t, size_t [], size_t [], split_weight, launch_mode)");
+    if (tasks_.empty())
+    {
+        throw std::runtime_error{"Task need to be compiled first"};
+    }
+    if (dim == 0 || dim > 3)
+    {
+        throw std::out_of_range{"Dimension needs to be 1, 2 or 3."};
+    }
+
+    // host memory becomes the only copy, partitions are written into it directly
+    std::vector<void *> host_ptrs(args_.size(), nullptr);
+    for (size_t i = 0; i < args_.size(); ++i)
+    {
+        if (args_[i].type == argument::kind::BUFFER)
+        {
+            host_ptrs[i] = args_[i].buffer->detach();
+        }
+    }
+
+    // partitions are whole work groups, the last one takes what is left
+    std::vector<double> weights = get_weights(weight);
+    double weight_sum = 0;
+    for (auto &w : weights)
+    {
+        weight_sum = weight_sum + w;
+    }
+
+    size_t group_num = (global_size[0] + local_size[0] - 1) / local_size[0];
+    std::vector<size_t> offsets(devices_.size() + 1, 0);
+    double accumulated = 0;
+    for (size_t d = 0; d < devices_.size(); ++d)
+    {
+        accumulated = accumulated + weights[d];
+        size_t group_end = d + 1 == devices_.size() ? group_num
+                                                   : static_cast<size_t>(group_num * accumulated / weight_sum + 0.5);
+        offsets[d + 1] = std::min(group_end * local_size[0], global_size[0]);
+    }
+
+    auto run = [&](size_t d) {
+        size_t partition_offset[3] = {offsets[d], 0, 0};
+        size_t partition_size[3] = {offsets[d + 1] - offsets[d], 1, 1};
+        for (size_t i = 1; i < dim; ++i)
+        {
+            partition_size[i] = global_size[i];
+        }
+        run_partition(d, dim, partition_offset, partition_size, local_size, mode, host_ptrs);
+    };
+
+    std::vector<bool> is_posted(devices_.size(), false);
+    for (size_t d = 1; d < devices_.size(); ++d)
+    {
+        if (offsets[d + 1] > offsets[d])
+        {
+            workers_[d - 1]->post([&run, d]() { run(d); });
+            is_posted[d] = true;
+        }
+    }
+
+    // every partition finishes before an error leaves, they share host_ptrs
+    std::exception_ptr error = nullptr;
+    if (offsets[1] > offsets[0])
+    {
+        try
+        {
+            run(0);
+        }
+        catch (...)
+        {
+            error = std::current_exception();
+        }
+    }
+    for (size_t d = 1; d < devices_.size(); ++d)
+    {
+        if (!is_posted[d])
+        {
+            continue;
+        }
+        try
+        {
+            workers_[d - 1]->wait();
+        }
+        catch (...)
+        {
+            error = error ? error : std::current_exception();
+        }
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+}
+} // namespace opencle
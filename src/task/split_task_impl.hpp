@@ -0,0 +1,126 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../util/core_def.hpp"
+#include "task_impl.hpp"
+
+namespace opencle
+{
+class split_task_impl;
+class device_impl;
+class global_ptr_impl;
+
+enum class split_weight
+{
+    // share of each device proportional to its compute units
+    COMPUTE_UNIT,
+    // share proportional to the work items per second measured on earlier runs,
+    // compute units until every device has been measured
+    THROUGHPUT
+};
+
+enum class split_access
+{
+    // the whole buffer is copied to every device
+    BROADCAST,
+    // each device receives the slice of its partition
+    SLICE_IN,
+    // each device writes the slice of its partition, merged back on the host
+    SLICE_OUT,
+    SLICE_IN_OUT
+};
+
+/** One kernel run across several devices. The range is partitioned along
+ * dimension 0 and every device runs its partition with a global work
+ * offset, so the kernel keeps indexing with get_global_id. A sliced buffer
+ * holds 'slice_size' bytes per index of dimension 0; each device only moves
+ * the bytes of its own partition. The calling thread runs the partition of
+ * the first device, a thread started by compile() that of each other one. */
+class split_task_impl final
+{
+private:
+    /** Runs the partitions of one device, one job at a time. */
+    struct partition_worker
+    {
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::function<void()> job;
+        bool is_busy = false;
+        bool is_stopped = false;
+        std::exception_ptr error;
+        std::thread thread;
+
+        partition_worker();
+        ~partition_worker();
+
+        void post(std::function<void()> next);
+        // rethrows the error of the job
+        void wait();
+    };
+
+    struct argument
+    {
+        enum class kind
+        {
+            NONE,
+            SCALAR,
+            LOCAL,
+            BUFFER
+        };
+
+        kind type;
+        std::vector<char> value;
+        size_t size;
+        global_ptr_impl *buffer;
+        size_t slice_size;
+        split_access access;
+    };
+
+    std::string source_;
+    std::string kernel_name_;
+    std::vector<device_impl *> devices_;
+    std::vector<std::unique_ptr<task_impl>> tasks_;
+    // workers_[d - 1] runs the partition of devices_[d]
+    std::vector<std::unique_ptr<partition_worker>> workers_;
+    std::vector<argument> args_;
+
+    std::mutex throughput_mutex_;
+    std::map<device_impl const *, double> throughput_;
+
+    argument &get_arg(size_t index);
+    std::vector<double> get_weights(split_weight weight);
+    void run_partition(size_t device_index, size_t dim, size_t global_offset[], size_t global_size[],
+                       size_t local_size[], launch_mode mode, std::vector<void *> const &host_ptrs);
+
+public:
+    split_task_impl(std::string const &source, std::string const &kernel_name);
+    split_task_impl(split_task_impl const &rhs) = delete;
+    split_task_impl(split_task_impl &&rhs) = delete;
+    ~split_task_impl();
+
+    split_task_impl &operator=(split_task_impl const &rhs) = delete;
+    split_task_impl &operator=(split_task_impl &&rhs) = delete;
+
+    void compile(std::vector<device_impl *> const &devices);
+
+    void set_arg(size_t index, size_t size, void const *value);
+    void set_arg_local(size_t index, size_t size);
+    void set_arg_buffer(size_t index, global_ptr_impl *buffer, split_access access, size_t slice_size = 0);
+
+    /** Run the range on every compiled device and merge the sliced outputs
+     * into the host memory of their global_ptr. The partitions run on the
+     * workers of this task, so exec is not called by two threads at once. */
+    void exec(size_t dim, size_t global_size[], size_t local_size[], split_weight weight = split_weight::COMPUTE_UNIT,
+              launch_mode mode = launch_mode::EXACT);
+};
+} // namespace opencle
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "../device/device.hpp"
+#include "../util/logger/logger.hpp"
+#include "argument/argument_binder.hpp"
+#include "task_impl.hpp"
+
+namespace opencle
+{
+template <typename... Args>
+class task;
+
+/** Typed kernel, 'Args' are the kernel parameters in order: POD scalars,
+ * global_ptr<T[]> buffers and local_memory<T> sizes. Arguments are checked
+ * at compile time and bound straight into the kernel, so a launch with an
+ * explicit local size does not allocate, unless more launches are in flight
+ * than task_impl has records for. */
+template <typename... Args>
+class task final
+{
+public:
+    // attempts of one exec, each on another device after a device failure
+    static constexpr size_t max_dispatch_num = 3;
+
+private:
+    std::unique_ptr<task_impl> impl_;
+    launch_mode mode_;
+
+    template <size_t... I>
+    void bind(kernel_lease const &kernel, std::index_sequence<I...>, argument_param_t<Args>... args)
+    {
+        (argument_binder<Args>::bind(*impl_, kernel, I, args), ...);
+    }
+
+    cl_uint wait(cl_event wait_list[], argument_param_t<Args>... args)
+    {
+        cl_uint wait_num = 0;
+        (argument_binder<Args>::wait(args, wait_list, wait_num), ...);
+        return wait_num;
+    }
+
+    void signal(cl_event done, argument_param_t<Args>... args)
+    {
+        (argument_binder<Args>::signal(args, done), ...);
+    }
+
+    void run(size_t dim, size_t global_size[], size_t local_size[], argument_param_t<Args>... args)
+    {
+        kernel_lease kernel = impl_->lease();
+        bind(kernel, std::index_sequence_for<Args...>{}, args...);
+
+        // ordered by the events of the buffers, the queue may be out-of-order
+        cl_event wait_list[max_wait_event_num_v<Args...> + 1];
+        cl_uint wait_num = wait(wait_list, args...);
+        cl_event done = nullptr;
+        impl_->exec(kernel, dim, NULL, global_size, local_size, mode_, wait_num, wait_list, &done);
+        if (done)
+        {
+            signal(done, args...);
+            clReleaseEvent(done);
+        }
+    }
+
+public:
+    task(std::string const &source, std::string const &kernel_name)
+        : impl_{std::make_unique<task_impl>(source, kernel_name)}, mode_{launch_mode::EXACT}
+    {
+        logger("task(std::string const &, std::string const &), create " << this);
+    }
+
+    task(task const &rhs) = delete;
+    task(task &&rhs) = default;
+    ~task() = default;
+
+    task &operator=(task const &rhs) = delete;
+    task &operator=(task &&rhs) = default;
+
+    void compile(device const &dev)
+    {
+        logger("compile(device const &)");
+        impl_->compile(dev.get_device_impl().get());
+    }
+
+    void set_build_options(std::string const &options)
+    {
+        impl_->set_build_options(options);
+    }
+
+    /** See task_impl::specialize, call compile() again to switch variant. */
+    template <typename T>
+    void specialize(std::string const &name, T const &value)
+    {
+        impl_->specialize(name, value);
+    }
+
+    void set_launch_mode(launch_mode mode)
+    {
+        mode_ = mode;
+    }
+
+    /** See task_impl::set_idempotent, needed for a nullptr 'local_size' to
+     * be tuned by benchmarking. */
+    void set_idempotent(bool is_idempotent)
+    {
+        impl_->set_idempotent(is_idempotent);
+    }
+
+    /** Bind 'args' and run the kernel, 'local_size' being nullptr means
+     * the local size is autotuned, see set_idempotent. Each call checks out its own kernel, so
+     * several threads may run the same task at once, as long as they do not
+     * share global_ptr arguments. The call returns once the kernel is
+     * enqueued, the buffers wait for it when they are used next. If the
+     * device fails, the task is compiled for device::select_device() and
+     * run again there, the buffers follow from their host copies; like
+     * compile(), that needs the other threads to have returned. */
+    void exec(size_t dim, size_t global_size[], size_t local_size[], argument_param_t<Args>... args)
+    {
+        logger("exec(size_t, size_t [], size_t [], Args...)");
+        for (size_t attempt = 1;; ++attempt)
+        {
+            if (impl_->is_device_failed())
+            {
+                impl_->failover();
+            }
+
+            try
+            {
+                run(dim, global_size, local_size, args...);
+                return;
+            }
+            catch (std::runtime_error const &)
+            {
+                // errors of the task itself are not retried
+                if (attempt == max_dispatch_num || !impl_->is_device_failed())
+                {
+                    throw;
+                }
+            }
+        }
+    }
+
+    /** See task_impl::get_kernel_identifier, e.g. for Task::set_kernel_name. */
+    std::string get_kernel_identifier() const
+    {
+        return impl_->get_kernel_identifier();
+    }
+
+    // for test purpose
+    std::unique_ptr<task_impl> const &get_task_impl() const
+    {
+        return impl_;
+    }
+};
+} // namespace opencle
@@ -1,18 +1,82 @@
-#define NDEBUG
-
 #include "task_impl.hpp"
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
 #include <utility>
 
 #include "../util/logger/logger.hpp"
+#include "../util/metrics/metrics.hpp"
+#include "../device/cost_model.hpp"
+#include "../device/device.hpp"
 #include "../device/device_impl.hpp"
 #include "../memory/global_ptr_impl.hpp"
+#include "../util/profiler/profiler.hpp"
+#include "../util/trace/trace.hpp"
+#include "kernel_pool.hpp"
+#include "program_cache.hpp"
+#include "work_size_tuner.hpp"
+
+namespace
+{
+constexpr size_t tuning_repeat_num = 3;
+
+size_t __get_work_items(size_t dim, size_t const global_size[])
+{
+    size_t work_items = 1;
+    for (size_t i = 0; i < dim; ++i)
+    {
+        work_items *= global_size[i];
+    }
+    return work_items;
+}
+
+// status of the first failed command among finished ones, so the failure
+// of a launch itself is told from one of a command it waited for
+cl_int __get_execution_status(cl_event const events[], size_t event_num)
+{
+    for (size_t i = 0; i < event_num; ++i)
+    {
+        cl_int status = CL_COMPLETE;
+        clGetEventInfo(events[i], CL_EVENT_COMMAND_EXECUTION_STATUS, sizeof(cl_int), &status, NULL);
+        if (status < 0)
+        {
+            return status;
+        }
+    }
+    return CL_SUCCESS;
+}
+
+// device time of completed kernels, without the time they waited behind
+// other commands; false if the queue does not profile
+bool __get_kernel_time(cl_event const events[], size_t event_num, double &seconds)
+{
+    seconds = 0;
+    for (size_t i = 0; i < event_num; ++i)
+    {
+        cl_ulong start;
+        cl_ulong end;
+        if (clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start, NULL) !=
+                CL_SUCCESS ||
+            clGetEventProfilingInfo(events[i], CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end, NULL) != CL_SUCCESS)
+        {
+            return false;
+        }
+        seconds += (end - start) / 1e9;
+    }
+    return true;
+}
+} // namespace
 
 namespace opencle
 {
 task_impl::task_impl(std::string const &source, std::string const &kernel_name)
-    : valid_{1}, source_{source}, kernel_name_{kernel_name},
-      program_{nullptr}, kernel_{nullptr}, on_device_{nullptr}
+    : valid_{1}, source_{source}, kernel_name_{kernel_name}, trace_name_{trace::intern(kernel_name)},
+      build_options_{}, constants_{}, is_idempotent_{false},
+      program_{nullptr}, kernel_{nullptr}, pool_{nullptr}, on_device_{nullptr}
 {
     logger("task_impl(std::string const &), create " << this);
 }
@@ -20,8 +84,15 @@ task_impl::task_impl(std::string const &source, std::string const &kernel_name)
 task_impl::~task_impl()
 {
     logger("~task_impl()");
-    clReleaseKernel(kernel_);
-    clReleaseProgram(program_);
+    pool_.reset();
+    if (kernel_)
+    {
+        clReleaseKernel(kernel_);
+    }
+    if (program_)
+    {
+        clReleaseProgram(program_);
+    }
 }
 
 task_impl::operator bool()
@@ -29,26 +100,70 @@ task_impl::operator bool()
     return valid_ == 7;
 }
 
+void task_impl::set_build_options(std::string const &options)
+{
+    logger("set_build_options(std::string const &)");
+    build_options_ = options;
+}
+
+void task_impl::set_idempotent(bool is_idempotent)
+{
+    logger("set_idempotent(bool)");
+    is_idempotent_ = is_idempotent;
+}
+
+void task_impl::define(std::string const &name, std::string const &value)
+{
+    logger("define(std::string const &, std::string const &)");
+    constants_[name] = value;
+}
+
+void task_impl::undefine(std::string const &name)
+{
+    logger("undefine(std::string const &)");
+    constants_.erase(name);
+}
+
+std::string task_impl::get_build_options() const
+{
+    // constants_ is ordered, so the same constants always give the same options
+    std::string options = build_options_;
+    for (auto const &constant : constants_)
+    {
+        options += " -D " + constant.first + "=" + constant.second;
+    }
+    return options;
+}
+
 void task_impl::compile(device_impl *dev_impl)
 {
+    pool_.reset();
+    if (kernel_)
+    {
+        clReleaseKernel(kernel_);
+        kernel_ = nullptr;
+    }
+    if (program_)
+    {
+        clReleaseProgram(program_);
+        program_ = nullptr;
+    }
+    valid_ = 1;
+
+    reserve_records();
     on_device_ = dev_impl;
+    cost_entry_ = cost_model::get_entry(cost_model::make_key(get_kernel_identifier(), on_device_));
+    trace_span span{trace_name_, "compile", on_device_};
 
     cl_int status;
-    char const *source = source_.c_str();
-    program_ = clCreateProgramWithSource(on_device_->get_context(), 1, &source, NULL, &status);
-    if (status != CL_SUCCESS)
+    try
     {
-        valid_ = 0;
-        throw std::runtime_error{"OpenCL runtime error: Cannot create program"};
+        program_ = program_cache::get(on_device_, source_, get_build_options());
     }
-
-    cl_device_id dev_id = on_device_->get_device_id();
-
-    status = clBuildProgram(program_, 1, &dev_id, NULL, NULL, NULL);
-    if (status != CL_SUCCESS)
+    catch (std::runtime_error const &)
     {
         valid_ = 0;
-        throw std::runtime_error{"OpenCL runtime error: Cannot build program"};
+        throw;
     }
 
     kernel_ = clCreateKernel(program_, kernel_name_.c_str(), &status);
@@ -58,12 +173,33 @@ void task_impl::compile(device_impl *dev_impl)
         throw std::runtime_error{"OpenCL runtime error: Cannot create kernel of " + kernel_name_};
     }
 
+    pool_ = std::make_unique<kernel_pool>(program_, kernel_name_);
+
     valid_ = valid_ | 2;
 }
 
+device_impl *task_impl::get_device() const
+{
+    return on_device_;
+}
+
+bool task_impl::is_device_failed() const
+{
+    return on_device_ && !*on_device_;
+}
+
+void task_impl::failover()
+{
+    logger("failover()");
+    device const &dev = device::select_device();
+    logger_warn("Device " << *on_device_ << " failed, dispatch " << kernel_name_ << " to device "
+                          << *dev.get_device_impl());
+    compile(dev.get_device_impl().get());
+}
+
 void task_impl::set_args(Args &&args)
 {
-    if (valid_ & 3 == 3)
+    if ((valid_ & 3) == 3)
     {
         cl_int status;
         size_t i = 0;
@@ -102,49 +238,508 @@ int task_impl::get_compute_unit_usage(size_t dim, size_t global_size[], size_t l
     int cu_usage = 1;
     for (size_t i = 0; i < dim; ++i)
     {
-        cu_usage = cu_usage * (global_size[i] / local_size[i]);
+        cu_usage = cu_usage * ((global_size[i] + local_size[i] - 1) / local_size[i]);
     }
     return cu_usage;
 }
 
-void task_impl::exec(size_t dim, size_t global_size[], size_t local_size[])
+void task_impl::set_real_size(cl_kernel kernel, size_t dim, size_t global_offset[], size_t global_size[])
 {
-    if (valid_ & 7 == 7)
+    cl_int status;
+    cl_uint arg_num;
+    status = clGetKernelInfo(kernel, CL_KERNEL_NUM_ARGS, sizeof(cl_uint), &arg_num, NULL);
+    if (status != CL_SUCCESS || arg_num < dim)
     {
-        if (is_valid_parallel_size(dim, global_size, local_size))
+        valid_ = 0;
+        throw std::runtime_error{"Padded launch needs one trailing ulong argument per dimension"};
+    }
+
+    for (size_t i = 0; i < dim; ++i)
+    {
+        cl_ulong real_size = (global_offset ? global_offset[i] : 0) + global_size[i];
+        status = clSetKernelArg(kernel, arg_num - dim + i, sizeof(cl_ulong), &real_size);
+        if (status != CL_SUCCESS)
         {
-            cl_int status;
-            cl_event event;
+            valid_ = 0;
+            throw std::runtime_error{"OpenCL runtime error: Cannot set argument"};
+        }
+    }
+}
 
-            size_t compute_unit_usage = get_compute_unit_usage(dim, global_size, local_size);
+size_t task_impl::launch(cl_command_queue queue, cl_kernel kernel, size_t dim, size_t global_offset[],
+                         size_t global_size[], size_t local_size[], launch_mode mode, cl_uint wait_num,
+                         cl_event const wait_list[], cl_event events[], cl_int &status)
+{
+    size_t event_num = 0;
 
-            on_device_->compute_unit_usage_increment(compute_unit_usage);
+    if (mode == launch_mode::EXACT)
+    {
+        cl_event event;
+        status = clEnqueueNDRangeKernel(queue, kernel, dim, global_offset, global_size, local_size, wait_num, wait_list, &event);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
+        }
+        events[event_num++] = event;
+    }
+    else if (mode == launch_mode::PADDED)
+    {
+        size_t padded_size[3];
+        for (size_t i = 0; i < dim; ++i)
+        {
+            padded_size[i] = (global_size[i] + local_size[i] - 1) / local_size[i] * local_size[i];
+        }
+        set_real_size(kernel, dim, global_offset, global_size);
 
-            clEnqueueNDRangeKernel(on_device_->get_command_queue(), kernel_, dim, NULL, global_size, local_size, 0, NULL, &event);
-            if (status != CL_SUCCESS)
+        cl_event event;
+        status = clEnqueueNDRangeKernel(queue, kernel, dim, global_offset, padded_size, local_size, wait_num, wait_list, &event);
+        if (status != CL_SUCCESS)
+        {
+            throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
+        }
+        events[event_num++] = event;
+    }
+    else
+    {
+        size_t bulk_size[3];
+        for (size_t i = 0; i < dim; ++i)
+        {
+            bulk_size[i] = global_size[i] - global_size[i] % local_size[i];
+        }
+
+        // every subset of dimensions in the tail forms one region, region 0 is the bulk
+        for (size_t region = 0; region < (static_cast<size_t>(1) << dim); ++region)
+        {
+            size_t offset[3];
+            size_t size[3];
+            bool is_empty = false;
+            for (size_t i = 0; i < dim; ++i)
             {
-                valid_ = 0;
-                throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
+                bool is_tail = region & (static_cast<size_t>(1) << i);
+                offset[i] = (global_offset ? global_offset[i] : 0) + (is_tail ? bulk_size[i] : 0);
+                size[i] = is_tail ? global_size[i] - bulk_size[i] : bulk_size[i];
+                is_empty = is_empty || size[i] == 0;
+            }
+            if (is_empty)
+            {
+                continue;
             }
 
-            status = clWaitForEvents(1, &event);
+            // the implementation picks a local size that fits the remainder
+            cl_event event;
+            status = clEnqueueNDRangeKernel(queue, kernel, dim, offset, size,
+                                            region == 0 ? local_size : NULL, wait_num, wait_list, &event);
             if (status != CL_SUCCESS)
             {
-                valid_ = 0;
+                for (size_t i = 0; i < event_num; ++i)
+                {
+                    clWaitForEvents(1, &events[i]);
+                    clReleaseEvent(events[i]);
+                }
                 throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
             }
+            events[event_num++] = event;
+        }
+    }
+    return event_num;
+}
+
+struct task_impl::launch_record
+{
+    device_impl *dev_impl;
+    std::shared_ptr<cost_entry> entry;
+    size_t compute_unit_usage;
+    double predicted_time;
+    size_t work_items;
+    std::chrono::steady_clock::time_point start;
+    size_t event_num;
+    cl_event events[max_launch_num];
+    launch_record *next;
+};
+
+std::mutex task_impl::record_mutex_ = std::mutex{};
+task_impl::launch_record *task_impl::free_records_ = nullptr;
+
+void task_impl::reserve_records()
+{
+    std::lock_guard<std::mutex> lock{record_mutex_};
+    if (free_records_)
+    {
+        return;
+    }
+    // never freed, a callback may still hand a record back at exit
+    launch_record *block = new launch_record[launch_record_block_num];
+    for (size_t i = 0; i < launch_record_block_num; ++i)
+    {
+        block[i].next = i + 1 < launch_record_block_num ? &block[i + 1] : nullptr;
+    }
+    free_records_ = block;
+}
+
+task_impl::launch_record *task_impl::acquire_record()
+{
+    {
+        std::lock_guard<std::mutex> lock{record_mutex_};
+        if (free_records_)
+        {
+            launch_record *rec = free_records_;
+            free_records_ = rec->next;
+            return rec;
+        }
+    }
+    reserve_records();
+    return acquire_record();
+}
+
+void task_impl::release_record(launch_record *rec)
+{
+    rec->entry.reset();
+    std::lock_guard<std::mutex> lock{record_mutex_};
+    rec->next = free_records_;
+    free_records_ = rec;
+}
+
+cl_int task_impl::complete_launch(launch_record &rec, cl_int status)
+{
+    rec.dev_impl->compute_unit_usage_increment(-rec.compute_unit_usage);
+    rec.dev_impl->queue_depth_increment(-1);
+    rec.dev_impl->backlog_increment(-rec.predicted_time);
+    rec.dev_impl->report_status(status);
+
+    // placement compares devices by this, see device_impl::get_completion_time
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - rec.start;
+    double kernel_time = elapsed.count();
+    if (status == CL_SUCCESS &&
+        (!rec.dev_impl->is_profiling() || __get_kernel_time(rec.events, rec.event_num, kernel_time)))
+    {
+        rec.entry->record(rec.work_items, kernel_time);
+    }
+    for (size_t i = 0; i < rec.event_num; ++i)
+    {
+        clReleaseEvent(rec.events[i]);
+    }
+    return status;
+}
+
+void task_impl::on_launch_complete(cl_event, cl_int status, void *user_data)
+{
+    launch_record *rec = static_cast<launch_record *>(user_data);
+    // a failed part may leave the event it was joined by complete
+    if (status == CL_SUCCESS)
+    {
+        status = __get_execution_status(rec->events, rec->event_num);
+    }
+    complete_launch(*rec, status < 0 ? status : CL_SUCCESS);
+    release_record(rec);
+}
+
+void task_impl::exec_kernel(cl_kernel kernel, size_t dim, size_t global_offset[], size_t global_size[],
+                            size_t local_size[], launch_mode mode, cl_uint wait_num, cl_event const wait_list[],
+                            cl_event *done)
+{
+    if (mode != launch_mode::EXACT || is_valid_parallel_size(dim, global_size, local_size))
+    {
+        static counter &launches = metrics::get_counter("opencle_kernel_launches_total", "Kernels run by task_impl");
+        cl_int status = CL_SUCCESS;
+        trace_span span{trace_name_, "exec", on_device_};
+        launches.add();
+
+        size_t compute_unit_usage = get_compute_unit_usage(dim, global_size, local_size);
+        size_t work_items = __get_work_items(dim, global_size);
+        double predicted_time = on_device_->get_runtime(*cost_entry_, work_items);
+
+        on_device_->compute_unit_usage_increment(compute_unit_usage);
+        on_device_->queue_depth_increment(1);
+        on_device_->backlog_increment(predicted_time);
 
+        // the parts of a remainder launch share one queue
+        cl_command_queue queue = on_device_->get_compute_queue();
+        auto start = std::chrono::steady_clock::now();
+        cl_event events[max_launch_num];
+        size_t event_num;
+        try
+        {
+            event_num = launch(queue, kernel, dim, global_offset, global_size, local_size, mode, wait_num, wait_list, events,
+                               status);
+        }
+        catch (std::runtime_error const &)
+        {
+            valid_ = 0;
+            on_device_->report_status(status);
             on_device_->compute_unit_usage_increment(-compute_unit_usage);
+            on_device_->queue_depth_increment(-1);
+            on_device_->backlog_increment(-predicted_time);
+            throw;
+        }
+        // every part of a remainder launch is one sample
+        for (size_t i = 0; i < event_num; ++i)
+        {
+            profiler::record_kernel(on_device_, kernel_name_, events[i]);
+        }
+
+        launch_record rec{on_device_, cost_entry_, compute_unit_usage, predicted_time, work_items, start, event_num,
+                          {}, nullptr};
+        std::copy(events, events + event_num, rec.events);
+
+        if (done)
+        {
+            // a remainder launch completes with the last of its parts
+            if (event_num == 1)
+            {
+                clRetainEvent(events[0]);
+                *done = events[0];
+            }
+            else
+            {
+                status = clEnqueueMarkerWithWaitList(queue, event_num, events, done);
+                if (status != CL_SUCCESS)
+                {
+                    *done = nullptr;
+                }
+            }
+
+            // the caller orders on 'done', the accounting follows it
+            if (*done)
+            {
+                launch_record *pending = acquire_record();
+                *pending = rec;
+                if (clSetEventCallback(*done, CL_COMPLETE, on_launch_complete, pending) == CL_SUCCESS)
+                {
+                    return;
+                }
+                release_record(pending);
+            }
+        }
+
+        {
+            trace_span wait_span{"wait", "exec", on_device_};
+            status = clWaitForEvents(event_num, events);
+        }
+        if (status == CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST)
+        {
+            cl_int cause = __get_execution_status(events, event_num);
+            status = cause != CL_SUCCESS ? cause : status;
+        }
+        status = complete_launch(rec, status);
+        if (status != CL_SUCCESS)
+        {
+            valid_ = 0;
+            if (done && *done)
+            {
+                clReleaseEvent(*done);
+                *done = nullptr;
+            }
+            throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
+        }
+    }
+    else
+    {
+        throw std::runtime_error{"Global size needs to be multiple of local size."};
+    }
+}
+
+std::string task_impl::get_kernel_identifier() const
+{
+    std::ostringstream identifier;
+    identifier << kernel_name_ << "#" << std::hex << std::hash<std::string>{}(source_ + get_build_options());
+    return identifier.str();
+}
+
+double task_impl::run_for_tuning(cl_kernel kernel, size_t dim, size_t global_size[], size_t local_size[], launch_mode mode)
+{
+    cl_int status;
+    double best = std::numeric_limits<double>::max();
+
+    for (size_t i = 0; i < tuning_repeat_num; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        cl_event events[max_launch_num];
+        size_t event_num;
+        try
+        {
+            event_num = launch(on_device_->get_compute_queue(), kernel, dim, NULL, global_size, local_size, mode, 0, NULL,
+                               events, status);
+        }
+        catch (std::runtime_error const &)
+        {
+            // e.g. the kernel uses too many resources for this local size,
+            // which is not reported against the device
+            return std::numeric_limits<double>::max();
+        }
+        status = clWaitForEvents(event_num, events);
+        for (size_t i = 0; i < event_num; ++i)
+        {
+            clReleaseEvent(events[i]);
+        }
+        if (status != CL_SUCCESS)
+        {
+            valid_ = 0;
+            throw std::runtime_error{"OpenCL runtime error: Cannot execute kernel"};
+        }
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best = std::min(best, elapsed.count());
+    }
+    return best;
+}
+
+void task_impl::tune_local_size(cl_kernel kernel, size_t dim, size_t global_size[], size_t local_size[], launch_mode mode)
+{
+    std::string key =
+        work_size_tuner::make_key(get_kernel_identifier(), on_device_, dim, global_size, mode == launch_mode::EXACT);
+    if (work_size_tuner::lookup(kernel, on_device_, key, dim, local_size) &&
+        (mode != launch_mode::EXACT || is_valid_parallel_size(dim, global_size, local_size)))
+    {
+        logger("Use tuned local size for " << key);
+        return;
+    }
+
+    std::vector<work_size_tuner::work_size> candidates =
+        work_size_tuner::get_candidates(kernel, on_device_, dim, global_size, mode == launch_mode::EXACT);
+    if (candidates.empty())
+    {
+        throw std::runtime_error{"No local size divides the global size."};
+    }
+
+    // benchmarking reruns the kernel on the live arguments of this launch
+    if (!is_idempotent_)
+    {
+        logger("Use untuned local size for " << key);
+        for (size_t i = 0; i < dim; ++i)
+        {
+            local_size[i] = candidates.front()[i];
         }
-        else
+        return;
+    }
+
+    double best_time = std::numeric_limits<double>::max();
+    work_size_tuner::work_size best = candidates.front();
+    for (auto &candidate : candidates)
+    {
+        double time = run_for_tuning(kernel, dim, global_size, candidate.data(), mode);
+        logger("Local size " << candidate[0] << "x" << candidate[1] << "x" << candidate[2] << " takes " << time << "s");
+        if (time < best_time)
         {
-            throw std::runtime_error{"Global size needs to be multiple of local size."};
+            best_time = time;
+            best = candidate;
         }
     }
+
+    for (size_t i = 0; i < dim; ++i)
+    {
+        local_size[i] = best[i];
+    }
+    work_size_tuner::store(key, dim, local_size);
+}
+
+void task_impl::wait_untracked()
+{
+    // arguments bound without events are only ordered by a single in-order queue
+    if (!on_device_->is_ordered())
+    {
+        on_device_->finish();
+    }
+}
+
+void task_impl::exec(size_t dim, size_t global_size[], size_t local_size[], launch_mode mode)
+{
+    if ((valid_ & 7) == 7)
+    {
+        wait_untracked();
+        exec_kernel(kernel_, dim, NULL, global_size, local_size, mode, 0, NULL, nullptr);
+    }
+    else
+    {
+        throw std::runtime_error{"Task need to be compiled and arguments need to be set."};
+    }
+}
+
+void task_impl::exec(size_t dim, size_t global_size[], launch_mode mode)
+{
+    if ((valid_ & 7) == 7)
+    {
+        if (dim == 0 || dim > 3)
+        {
+            throw std::out_of_range{"Dimension needs to be 1, 2 or 3."};
+        }
+        wait_untracked();
+        size_t local_size[3] = {1, 1, 1};
+        tune_local_size(kernel_, dim, global_size, local_size, mode);
+        exec_kernel(kernel_, dim, NULL, global_size, local_size, mode, 0, NULL, nullptr);
+    }
     else
     {
         throw std::runtime_error{"Task need to be compiled and arguments need to be set."};
     }
 }
 
-} // namespace opencle
\ No newline at end of file
+kernel_lease task_impl::lease()
+{
+    if ((valid_ & 3) == 3)
+    {
+        return kernel_lease{*pool_};
+    }
+    else
+    {
+        throw std::runtime_error{"Task need to be compiled first"};
+    }
+}
+
+void task_impl::set_arg(kernel_lease const &kernel, size_t index, size_t size, void const *value)
+{
+    cl_int status = clSetKernelArg(kernel.get(), index, size, value);
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot set argument"};
+    }
+}
+
+void task_impl::exec(kernel_lease const &kernel, size_t dim, size_t global_size[], size_t local_size[],
+                     launch_mode mode)
+{
+    wait_untracked();
+    exec_kernel(kernel.get(), dim, NULL, global_size, local_size, mode, 0, NULL, nullptr);
+}
+
+void task_impl::exec(kernel_lease const &kernel, size_t dim, size_t global_offset[], size_t global_size[],
+                     size_t local_size[], launch_mode mode)
+{
+    wait_untracked();
+    exec_kernel(kernel.get(), dim, global_offset, global_size, local_size, mode, 0, NULL, nullptr);
+}
+
+void task_impl::exec(kernel_lease const &kernel, size_t dim, size_t global_size[], launch_mode mode)
+{
+    if (dim == 0 || dim > 3)
+    {
+        throw std::out_of_range{"Dimension needs to be 1, 2 or 3."};
+    }
+    wait_untracked();
+    size_t local_size[3] = {1, 1, 1};
+    tune_local_size(kernel.get(), dim, global_size, local_size, mode);
+    exec_kernel(kernel.get(), dim, NULL, global_size, local_size, mode, 0, NULL, nullptr);
+}
+
+void task_impl::exec(kernel_lease const &kernel, size_t dim, size_t global_offset[], size_t global_size[],
+                     size_t local_size[], launch_mode mode, cl_uint wait_num, cl_event const wait_list[], cl_event *done)
+{
+    if (local_size)
+    {
+        exec_kernel(kernel.get(), dim, global_offset, global_size, local_size, mode, wait_num, wait_list, done);
+        return;
+    }
+
+    if (dim == 0 || dim > 3)
+    {
+        throw std::out_of_range{"Dimension needs to be 1, 2 or 3."};
+    }
+    // tuning runs the kernel on its own, so the inputs have to be ready first
+    if (wait_num > 0 && clWaitForEvents(wait_num, wait_list) != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot wait for events"};
+    }
+    size_t tuned_size[3] = {1, 1, 1};
+    tune_local_size(kernel.get(), dim, global_size, tuned_size, mode);
+    exec_kernel(kernel.get(), dim, global_offset, global_size, tuned_size, mode, 0, NULL, done);
+}
+
+} // namespace opencle
@@ -1,35 +1,94 @@
 #pragma once
 
 #include <CL/cl.h>
+#include <atomic>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <sstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include "../util/core_def.hpp"
+#include "kernel_pool.hpp"
 
 namespace opencle
 {
 class task_impl;
 class device_impl;
+class cost_entry;
 class global_ptr_impl;
 
+enum class launch_mode
+{
+    // global size has to be a multiple of local size
+    EXACT,
+    // bulk of the range with the local size, the tail as separate launches with global offsets
+    REMAINDER,
+    // global size rounded up to the local size, the real size is passed in the
+    // trailing 'dim' ulong arguments of the kernel, which have to bound-check
+    PADDED
+};
+
 class task_impl final
 {
 private:
     using Args = std::vector<std::pair<size_t, void *>>;
 
-    char valid_;
+    // a remainder launch needs at most one launch per subset of the 3 dimensions
+    static constexpr size_t max_launch_num = 8;
+
+    std::atomic<char> valid_;
 
     std::string source_;
     std::string kernel_name_;
+    char const *trace_name_;
+    std::string build_options_;
+    std::map<std::string, std::string> constants_;
+    // the kernel may be run again on the arguments of a launch, for tuning
+    bool is_idempotent_;
 
     cl_program program_;
     cl_kernel kernel_;
+    std::unique_ptr<kernel_pool> pool_;
     device_impl *on_device_;
 
+    // cost_model entry of the kernel on on_device_, looked up by compile
+    std::shared_ptr<cost_entry> cost_entry_;
+
+    // device accounting of a launch in flight, settled when it completes
+    struct launch_record;
+
+    // records of launches completing by callback are recycled, so a launch
+    // only allocates when more are in flight than ever before
+    static constexpr size_t launch_record_block_num = 64;
+    static std::mutex record_mutex_;
+    static launch_record *free_records_;
+
+    static void reserve_records();
+    static launch_record *acquire_record();
+    static void release_record(launch_record *rec);
+    static cl_int complete_launch(launch_record &rec, cl_int status);
+    static void on_launch_complete(cl_event event, cl_int status, void *user_data);
+
     static int get_compute_unit_usage(size_t dim, size_t global_size[], size_t local_size[]);
     static bool is_valid_parallel_size(size_t dim, size_t global_size[], size_t local_size[]); 
 
+    void set_real_size(cl_kernel kernel, size_t dim, size_t global_offset[], size_t global_size[]);
+    size_t launch(cl_command_queue queue, cl_kernel kernel, size_t dim, size_t global_offset[], size_t global_size[],
+                  size_t local_size[], launch_mode mode, cl_uint wait_num, cl_event const wait_list[],
+                  cl_event events[], cl_int &status);
+    void exec_kernel(cl_kernel kernel, size_t dim, size_t global_offset[], size_t global_size[], size_t local_size[],
+                     launch_mode mode, cl_uint wait_num, cl_event const wait_list[], cl_event *done);
+
+    std::string get_build_options() const;
+    double run_for_tuning(cl_kernel kernel, size_t dim, size_t global_size[], size_t local_size[], launch_mode mode);
+    void tune_local_size(cl_kernel kernel, size_t dim, size_t global_size[], size_t local_size[], launch_mode mode);
+    void wait_untracked();
+
 public:
     task_impl(std::string const &source, std::string const &kernel_name);
     task_impl(task_impl const &rhs) = delete;
@@ -40,8 +99,93 @@ public:
     task_impl &operator=(task_impl &&rhs) = delete;
     operator bool();
 
+    /** Options passed to clBuildProgram, e.g. "-cl-fast-relaxed-math
+     * -cl-mad-enable", takes effect on the next compile. */
+    void set_build_options(std::string const &options);
+
+    /** Declare that running the kernel twice on the same arguments gives
+     * the same result as running it once, e.g. no accumulation into or
+     * in-place update of its inputs. Only then may an autotuning launch
+     * benchmark local sizes by running the kernel on its own arguments;
+     * otherwise a size missing from the work size table is picked without
+     * running anything and not stored. Off by default. */
+    void set_idempotent(bool is_idempotent);
+
+    /** Bake 'value' into the program as the macro 'name', takes effect on
+     * the next compile. Each distinct set of constants is a separate
+     * program, built once and shared through the program cache. */
+    template <typename T>
+    void specialize(std::string const &name, T const &value)
+    {
+        static_assert(std::is_arithmetic_v<T>, "only arithmetic value can be specialized");
+        std::ostringstream literal;
+        if constexpr (std::is_same_v<T, bool>)
+        {
+            literal << (value ? 1 : 0);
+        }
+        else if constexpr (std::is_floating_point_v<T>)
+        {
+            literal << std::setprecision(std::numeric_limits<T>::max_digits10) << std::showpoint << value
+                    << (std::is_same_v<T, float> ? "f" : "");
+        }
+        else
+        {
+            literal << +value;
+        }
+        define(name, literal.str());
+    }
+    void define(std::string const &name, std::string const &value);
+    void undefine(std::string const &name);
+
     void compile(device_impl *dev_impl);
     void set_args(Args &&args);
-    void exec(size_t dim, size_t global_size[], size_t local_size[]);
+
+    device_impl *get_device() const;
+
+    /** Kernel name and a hash of the source and build options, so programs
+     * sharing a kernel name are told apart; the key of the task in the work
+     * size table and in cost_model. */
+    std::string get_kernel_identifier() const;
+
+    /** Whether the device compiled for has failed, see
+     * device_impl::mark_failed. */
+    bool is_device_failed() const;
+
+    /** Compile again for device::select_device(), after the device failed. */
+    void failover();
+
+    void exec(size_t dim, size_t global_size[], size_t local_size[], launch_mode mode = launch_mode::EXACT);
+
+    /** Autotuning mode, the local size is taken from the work size table, or
+     * on first use found by benchmarking the candidates if the task is
+     * set_idempotent, see there. */
+    void exec(size_t dim, size_t global_size[], launch_mode mode = launch_mode::EXACT);
+
+    /** Concurrent launches, each host thread checks out its own kernel
+     * from the pool, binds the arguments on it and runs it. compile() must
+     * not be called while a lease is alive. */
+    kernel_lease lease();
+
+    /** Bind a single argument, 'value' is copied by OpenCL before returning,
+     * and 'value' being nullptr means local memory of 'size' bytes. */
+    void set_arg(kernel_lease const &kernel, size_t index, size_t size, void const *value);
+    void exec(kernel_lease const &kernel, size_t dim, size_t global_size[], size_t local_size[],
+              launch_mode mode = launch_mode::EXACT);
+    void exec(kernel_lease const &kernel, size_t dim, size_t global_size[], launch_mode mode = launch_mode::EXACT);
+
+    /** Run the part of the range starting at 'global_offset', in PADDED
+     * mode the kernel receives global_offset + global_size as the bound. */
+    void exec(kernel_lease const &kernel, size_t dim, size_t global_offset[], size_t global_size[],
+              size_t local_size[], launch_mode mode = launch_mode::EXACT);
+
+    /** Ordered by events instead of the queue, as needed on an out-of-order
+     * queue: the launch starts after the 'wait_num' events of 'wait_list'
+     * and, if 'done' is not nullptr, it receives an event completing with
+     * the launch, to be released by the caller. With 'done' the call returns
+     * once the launch is enqueued, errors while it runs show on that event
+     * and count against the device. 'global_offset' may be nullptr, and
+     * 'local_size' being nullptr means autotuning, see set_idempotent. */
+    void exec(kernel_lease const &kernel, size_t dim, size_t global_offset[], size_t global_size[],
+              size_t local_size[], launch_mode mode, cl_uint wait_num, cl_event const wait_list[], cl_event *done);
 };
 } // namespace opencle
@@ -0,0 +1,268 @@
+#include "work_size_tuner.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "../device/device_impl.hpp"
+#include "../util/logger/logger.hpp"
+
+namespace
+{
+constexpr size_t max_candidate_num = 16;
+
+// larger than the work groups of any device, anything above is corrupt
+constexpr size_t max_loaded_group_size = static_cast<size_t>(1) << 16;
+
+std::string __get_default_table_path()
+{
+    char const *path = std::getenv("OPENCLE_WORK_SIZE_TABLE");
+    return path ? std::string{path} : std::string{"opencle_work_size.txt"};
+}
+
+void __get_limits(cl_kernel kernel, cl_device_id dev_id, size_t &max_group_size, size_t max_item_size[3])
+{
+    cl_int status =
+        clGetKernelWorkGroupInfo(kernel, dev_id, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size_t), &max_group_size, NULL);
+    if (status != CL_SUCCESS)
+    {
+        throw std::runtime_error{"OpenCL runtime error: Cannot get kernel work group info"};
+    }
+
+    max_item_size[0] = max_item_size[1] = max_item_size[2] = max_group_size;
+    clGetDeviceInfo(dev_id, CL_DEVICE_MAX_WORK_ITEM_SIZES, 3 * sizeof(size_t), max_item_size, NULL);
+}
+
+size_t __get_bucket(size_t size)
+{
+    size_t bucket = 0;
+    while ((static_cast<size_t>(1) << bucket) < size)
+    {
+        ++bucket;
+    }
+    return bucket;
+}
+} // namespace
+
+namespace opencle
+{
+std::mutex work_size_tuner::table_mutex_ = std::mutex{};
+std::map<std::string, work_size_tuner::entry> work_size_tuner::table_ =
+    std::map<std::string, work_size_tuner::entry>{};
+std::string work_size_tuner::table_path_ = __get_default_table_path();
+bool work_size_tuner::is_table_loaded_ = false;
+
+void work_size_tuner::load_table()
+{
+    logger("load_table()");
+    table_.clear();
+
+    std::ifstream in{table_path_};
+    std::string line;
+    while (std::getline(in, line))
+    {
+        std::istringstream fields{line};
+        std::string key;
+        work_size local_size{1, 1, 1};
+        if (!(fields >> key >> local_size[0] >> local_size[1] >> local_size[2]))
+        {
+            continue;
+        }
+        // an empty group, or one no device has, would fail every launch
+        if (local_size[0] == 0 || local_size[1] == 0 || local_size[2] == 0 ||
+            local_size[0] > max_loaded_group_size / local_size[1] / local_size[2])
+        {
+            logger_warn("Ignore invalid work size entry " << key);
+            continue;
+        }
+        table_[key] = entry{local_size, false};
+    }
+    is_table_loaded_ = true;
+    logger("Load " << table_.size() << " entries from " << table_path_);
+}
+
+void work_size_tuner::save_table()
+{
+    logger("save_table()");
+    std::ofstream out{table_path_, std::ios::trunc};
+    if (!out)
+    {
+        logger_warn("Cannot write work size table to " << table_path_);
+        return;
+    }
+    for (auto const &item : table_)
+    {
+        work_size const &local_size = item.second.local_size;
+        out << item.first << " " << local_size[0] << " " << local_size[1] << " " << local_size[2] << "\n";
+    }
+}
+
+void work_size_tuner::set_table_path(std::string const &path)
+{
+    logger("set_table_path(std::string const &)");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    table_path_ = path;
+    load_table();
+}
+
+std::string work_size_tuner::get_table_path()
+{
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    return table_path_;
+}
+
+std::string work_size_tuner::make_key(std::string const &kernel_id, device_impl const *dev_impl, size_t dim,
+                                      size_t const global_size[], bool exact)
+{
+    logger("make_key(std::string const &, device_impl const *, size_t, size_t const [], bool)");
+    std::ostringstream key;
+    key << kernel_id << "|" << dev_impl->get_identifier() << "|";
+    for (size_t i = 0; i < dim; ++i)
+    {
+        // sizes in one bucket share no divisor, so an exact launch keys the size itself
+        key << (i ? "x" : "");
+        if (exact)
+        {
+            key << "=" << global_size[i];
+        }
+        else
+        {
+            key << __get_bucket(global_size[i]);
+        }
+    }
+    return key.str();
+}
+
+bool work_size_tuner::lookup(cl_kernel kernel, device_impl const *dev_impl, std::string const &key, size_t dim,
+                             size_t local_size[])
+{
+    logger("lookup(cl_kernel, device_impl const *, std::string const &, size_t, size_t [])");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    if (!is_table_loaded_)
+    {
+        load_table();
+    }
+
+    auto it = table_.find(key);
+    if (it == table_.end())
+    {
+        return false;
+    }
+
+    work_size const &tuned = it->second.local_size;
+    if (!it->second.is_checked)
+    {
+        size_t max_group_size;
+        size_t max_item_size[3];
+        __get_limits(kernel, dev_impl->get_device_id(), max_group_size, max_item_size);
+        bool is_valid = tuned[0] * tuned[1] * tuned[2] <= max_group_size;
+        for (size_t i = 0; i < 3 && is_valid; ++i)
+        {
+            is_valid = tuned[i] <= max_item_size[i];
+        }
+        if (!is_valid)
+        {
+            logger_warn("Drop work size entry " << key << " exceeding the kernel work group limits");
+            table_.erase(it);
+            return false;
+        }
+        it->second.is_checked = true;
+    }
+    for (size_t i = 0; i < dim; ++i)
+    {
+        local_size[i] = tuned[i];
+    }
+    return true;
+}
+
+void work_size_tuner::store(std::string const &key, size_t dim, size_t const local_size[])
+{
+    logger("store(std::string const &, size_t, size_t const [])");
+    std::lock_guard<std::mutex> lock{table_mutex_};
+    if (!is_table_loaded_)
+    {
+        load_table();
+    }
+
+    work_size tuned{1, 1, 1};
+    for (size_t i = 0; i < dim; ++i)
+    {
+        tuned[i] = local_size[i];
+    }
+    table_[key] = entry{tuned, true};
+    save_table();
+}
+
+std::vector<work_size_tuner::work_size> work_size_tuner::get_candidates(cl_kernel kernel, device_impl const *dev_impl,
+                                                                        size_t dim, size_t const global_size[], bool exact)
+{
+    logger("get_candidates(cl_kernel, device_impl const *, size_t, size_t const [], bool)");
+    cl_int status;
+    cl_device_id dev_id = dev_impl->get_device_id();
+
+    size_t max_group_size;
+    size_t max_item_size[3];
+    __get_limits(kernel, dev_id, max_group_size, max_item_size);
+
+    size_t multiple;
+    status = clGetKernelWorkGroupInfo(kernel, dev_id, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t),
+                                      &multiple, NULL);
+    if (status != CL_SUCCESS || multiple == 0)
+    {
+        multiple = 1;
+    }
+
+    // the first dimension grows in multiples of the preferred size, the others in powers of two
+    std::vector<size_t> first;
+    for (size_t s = multiple; s <= max_group_size && s <= max_item_size[0]; s *= 2)
+    {
+        first.push_back(s);
+    }
+    for (size_t s = multiple / 2; s >= 1; s /= 2)
+    {
+        first.push_back(s);
+    }
+
+    std::vector<size_t> other;
+    for (size_t s = 1; s <= max_group_size; s *= 2)
+    {
+        other.push_back(s);
+    }
+
+    std::vector<work_size> candidates;
+    for (size_t l0 : first)
+    {
+        for (size_t l1 : (dim > 1 ? other : std::vector<size_t>{1}))
+        {
+            for (size_t l2 : (dim > 2 ? other : std::vector<size_t>{1}))
+            {
+                work_size local_size{l0, l1, l2};
+                bool is_valid = l0 * l1 * l2 <= max_group_size;
+                for (size_t i = 0; i < dim && is_valid; ++i)
+                {
+                    is_valid = local_size[i] <= max_item_size[i] && local_size[i] <= global_size[i] &&
+                               (!exact || global_size[i] % local_size[i] == 0);
+                }
+                if (is_valid)
+                {
+                    candidates.push_back(local_size);
+                }
+            }
+        }
+    }
+
+    // benchmarking is paid on first use, so only the largest groups are worth trying
+    std::stable_sort(candidates.begin(), candidates.end(), [](work_size const &lhs, work_size const &rhs) {
+        return lhs[0] * lhs[1] * lhs[2] > rhs[0] * rhs[1] * rhs[2];
+    });
+    if (candidates.size() > max_candidate_num)
+    {
+        candidates.resize(max_candidate_num);
+    }
+    logger("There are " << candidates.size() << " candidate local sizes");
+
+    return candidates;
+}
+} // namespace opencle
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <array>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "../util/core_def.hpp"
+
+namespace opencle
+{
+class work_size_tuner;
+class device_impl;
+
+/** Keeps the best local work size found for each (kernel, device, global
+ * size), backed by a plain text table on disk. The table is loaded on first
+ * use and rewritten every time a new winner is stored. Launches that must
+ * divide the global size exactly are keyed by the exact size, the others by
+ * a power of two bucket per dimension. */
+class work_size_tuner final
+{
+public:
+    using work_size = std::array<size_t, 3>;
+
+private:
+    struct entry
+    {
+        work_size local_size;
+        // checked against the limits of the kernel on the device since load
+        bool is_checked;
+    };
+
+    static std::mutex table_mutex_;
+    static std::map<std::string, entry> table_;
+    static std::string table_path_;
+    static bool is_table_loaded_;
+
+    static void load_table();
+    static void save_table();
+
+public:
+    work_size_tuner() = delete;
+
+    /** Default path is $OPENCLE_WORK_SIZE_TABLE, or "opencle_work_size.txt"
+     * if the variable is not set. Setting a new path reloads the table. */
+    static void set_table_path(std::string const &path);
+    static std::string get_table_path();
+
+    static std::string make_key(std::string const &kernel_id, device_impl const *dev_impl, size_t dim,
+                                size_t const global_size[], bool exact);
+
+    /** False if 'key' has no entry, or its entry exceeds the work group
+     * limits of 'kernel' on 'dev_impl', in which case it is dropped. */
+    static bool lookup(cl_kernel kernel, device_impl const *dev_impl, std::string const &key, size_t dim,
+                       size_t local_size[]);
+    static void store(std::string const &key, size_t dim, size_t const local_size[]);
+
+    /** Candidate local sizes derived from CL_KERNEL_WORK_GROUP_SIZE and
+     * CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE. If 'exact' is set, only
+     * sizes that divide 'global_size' in every dimension are returned. */
+    static std::vector<work_size> get_candidates(cl_kernel kernel, device_impl const *dev_impl, size_t dim,
+                                                 size_t const global_size[], bool exact = true);
+};
+} // namespace opencle
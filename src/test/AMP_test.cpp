@@ -0,0 +1,364 @@
+#include <CL/cl.h>
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+#include "../AMP.hpp"
+#include "../Task.hpp"
+#include "../device/device.hpp"
+#include "../device/device_impl.hpp"
+#include "../memory/global_ptr.hpp"
+#include "../task/task.hpp"
+#include "../util/core_def.hpp"
+
+// OpenCL C code
+std::string programSource = "__kernel \n"
+                            "void vecadd_scale(__global int *A, __global int *B, __global int *C, int k) \n"
+                            "{ \n"
+                            "   int idx = get_global_id(0); \n"
+                            "   C[idx] = k * (A[idx] + B[idx]); \n"
+                            "} \n";
+
+namespace opencle_test
+{
+// holds the tasks waiting on it until it is opened
+class gate
+{
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool is_open_ = false;
+
+public:
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock{mutex_};
+        cv_.wait(lock, [this]() { return is_open_; });
+    }
+
+    void open()
+    {
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            is_open_ = true;
+        }
+        cv_.notify_all();
+    }
+};
+
+// the one device of a type only it has, so tasks of that type queue on it
+bool get_unique_type(opencle::device_type &unique)
+{
+    std::pair<opencle::device_type, cl_device_type> const types[] = {
+        {opencle::device_type::CPU, CL_DEVICE_TYPE_CPU},
+        {opencle::device_type::GPU, CL_DEVICE_TYPE_GPU},
+        {opencle::device_type::ACCELERATOR, CL_DEVICE_TYPE_ACCELERATOR}};
+    for (auto const &type : types)
+    {
+        int num = 0;
+        for (auto const &dev : opencle::device::get_device_list())
+        {
+            cl_device_type dev_type = 0;
+            clGetDeviceInfo(dev.get_device_impl()->get_device_id(), CL_DEVICE_TYPE, sizeof(cl_device_type), &dev_type,
+                            NULL);
+            num += (dev_type & type.second) != 0;
+        }
+        if (num == 1)
+        {
+            unique = type.first;
+            return true;
+        }
+    }
+    return false;
+}
+
+void test()
+{
+    constexpr int element_num = 16;
+    constexpr int task_num = 32;
+
+    std::atomic<int> done_num{0};
+    std::atomic<int> error_num{0};
+    std::atomic<int> wrong_num{0};
+
+    {
+        // room for the whole batch, so try_exec below is admitted
+        opencle::scheduler_option option;
+        option.max_pending_num = task_num + 2;
+        opencle::AMP amp{opencle::Device_Type::ALL, option};
+        amp.print_info();
+
+        // placement knows the kernel by the identifier its launches record under
+        opencle::task<opencle::global_ptr<int[]>, opencle::global_ptr<int[]>, opencle::global_ptr<int[]>, int>
+            vec_add_prototype{programSource, "vecadd_scale"};
+
+        for (int t = 0; t < task_num; ++t)
+        {
+            // each task runs on whichever device the scheduler picks
+            opencle::Task work{[t, &wrong_num](opencle::device const &dev) {
+                using int_buffer = opencle::global_ptr<int[]>;
+                int input_1_host[element_num];
+                int input_2_host[element_num];
+                for (int i = 0; i < element_num; ++i)
+                {
+                    input_1_host[i] = i;
+                    input_2_host[i] = 4 * i;
+                }
+                int_buffer input_1(input_1_host, element_num);
+                int_buffer input_2(input_2_host, element_num);
+                int_buffer output(static_cast<size_t>(element_num));
+
+                opencle::task<int_buffer, int_buffer, int_buffer, int> vec_add_task{programSource, "vecadd_scale"};
+                vec_add_task.compile(dev);
+                size_t global_size[1] = {element_num};
+                size_t local_size[1] = {4};
+                vec_add_task.exec(1, global_size, local_size, input_1, input_2, output, t);
+
+                for (int i = 0; i < element_num; ++i)
+                {
+                    if (output[i] != 5 * i * t)
+                    {
+                        ++wrong_num;
+                    }
+                }
+            }};
+            work.set_kernel_name(vec_add_prototype, element_num);
+            amp.exec(std::move(work), [&done_num, &error_num](std::exception_ptr error) {
+                ++done_num;
+                error_num += error != nullptr;
+            });
+        }
+
+        // errors of a task come back through its call back
+        amp.exec(opencle::Task{[](opencle::device const &) { throw std::runtime_error{"expected"}; }},
+                 [&done_num, &error_num](std::exception_ptr error) {
+                     ++done_num;
+                     assert(error != nullptr);
+                     error_num -= 1;
+                 });
+
+        bool is_admitted = amp.try_exec(opencle::Task{[](opencle::device const &) {}},
+                                        [&done_num](std::exception_ptr) { ++done_num; });
+        assert(is_admitted);
+    }
+
+    // the last AMP waits for every submitted task
+    std::cout << done_num << " tasks done" << std::endl;
+    assert(done_num == task_num + 2);
+    assert(error_num == -1);
+    assert(wrong_num == 0);
+}
+void test_priority()
+{
+    using clock = std::chrono::steady_clock;
+    constexpr int batch_num = 64;
+
+    // declared before the AMP, whose destructor runs the tasks still queued
+    std::atomic<int> batch_done_num{0};
+    std::mutex urgent_mutex;
+    std::condition_variable urgent_cv;
+    bool is_urgent_done = false;
+    int batch_done_before_urgent = -1;
+    gate blocker;
+    std::atomic<bool> is_blocking{false};
+    std::mutex order_mutex;
+    std::vector<int> order;
+
+    opencle::scheduler_option option;
+    option.reserved_num = 1;
+    opencle::AMP amp{opencle::Device_Type::ALL, option};
+    int device_num = static_cast<int>(opencle::device::get_device_list().size());
+
+    // a long batch, its tasks take the general threads of every device
+    for (int t = 0; t < batch_num * device_num; ++t)
+    {
+        amp.exec(opencle::Task{[](opencle::device const &) { std::this_thread::sleep_for(std::chrono::milliseconds{20}); }},
+                 [&batch_done_num](std::exception_ptr error) {
+                     assert(error == nullptr);
+                     ++batch_done_num;
+                 });
+    }
+
+    // a request queued behind it runs on the reserved threads right away
+    opencle::Task urgent{[](opencle::device const &) {}};
+    urgent.set_priority(opencle::task_priority::HIGH).set_deadline(clock::now() + std::chrono::seconds{1});
+    amp.exec(std::move(urgent), [&](std::exception_ptr error) {
+        assert(error == nullptr);
+        std::lock_guard<std::mutex> lock{urgent_mutex};
+        batch_done_before_urgent = batch_done_num;
+        is_urgent_done = true;
+        urgent_cv.notify_all();
+    });
+    {
+        std::unique_lock<std::mutex> lock{urgent_mutex};
+        urgent_cv.wait_for(lock, std::chrono::seconds{10}, [&]() { return is_urgent_done; });
+        assert(is_urgent_done);
+    }
+    std::cout << batch_done_before_urgent << " of " << batch_num * device_num << " batch tasks done before the HIGH one"
+              << std::endl;
+    assert(batch_done_before_urgent < batch_num * device_num);
+
+    // within a class the earliest deadline runs first, checked on a device
+    // that is the only one of its type, so the tasks cannot run elsewhere
+    opencle::device_type unique;
+    if (!get_unique_type(unique))
+    {
+        std::cout << "No device has a type of its own, skip the deadline order" << std::endl;
+        return;
+    }
+
+    amp.exec(opencle::Task{[&](opencle::device const &) {
+                               is_blocking = true;
+                               blocker.wait();
+                           },
+                           unique},
+             [](std::exception_ptr error) { assert(error == nullptr); });
+    while (!is_blocking)
+    {
+        std::this_thread::yield();
+    }
+
+    // queued in the reverse order of their deadlines, behind the blocker
+    auto now = clock::now();
+    for (int t : {2, 1})
+    {
+        opencle::Task timed{[&order_mutex, &order, t](opencle::device const &) {
+                                std::lock_guard<std::mutex> lock{order_mutex};
+                                order.push_back(t);
+                            },
+                            unique};
+        timed.set_deadline(now + std::chrono::hours{t});
+        amp.exec(std::move(timed), [](std::exception_ptr error) { assert(error == nullptr); });
+    }
+
+    // both are placed before the general thread is free again
+    std::this_thread::sleep_for(std::chrono::milliseconds{200});
+    blocker.open();
+    while (true)
+    {
+        {
+            std::lock_guard<std::mutex> lock{order_mutex};
+            if (order.size() == 2)
+            {
+                break;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    assert(order[0] == 1 && order[1] == 2);
+}
+void test_admission()
+{
+    using int_buffer = opencle::global_ptr<int[]>;
+    auto nothing = [](opencle::device const &) {};
+
+    // REJECT throws at the limit, try_exec returns false and leaves the task
+    std::atomic<int> done_num{0};
+    {
+        gate blocker;
+        bool is_rejected_run = false;
+        opencle::scheduler_option option;
+        option.max_pending_num = 2;
+        option.policy = opencle::admission_policy::REJECT;
+        opencle::AMP amp{opencle::Device_Type::ALL, option};
+        for (int t = 0; t < 2; ++t)
+        {
+            amp.exec(opencle::Task{[&blocker](opencle::device const &) { blocker.wait(); }},
+                     [&done_num](std::exception_ptr) { ++done_num; });
+        }
+
+        bool is_thrown = false;
+        try
+        {
+            amp.exec(opencle::Task{nothing}, [&done_num](std::exception_ptr) { ++done_num; });
+        }
+        catch (std::runtime_error const &)
+        {
+            is_thrown = true;
+        }
+        assert(is_thrown);
+
+        opencle::Task rejected{[&is_rejected_run](opencle::device const &) { is_rejected_run = true; }};
+        rejected.set_priority(opencle::task_priority::LOW);
+        bool is_admitted = amp.try_exec(std::move(rejected), [&done_num](std::exception_ptr) { ++done_num; });
+        assert(!is_admitted);
+        assert(rejected.get_priority() == opencle::task_priority::LOW);
+        rejected(opencle::device::get_device_list().front());
+        assert(is_rejected_run);
+
+        blocker.open();
+    }
+    assert(done_num == 2);
+
+    // BLOCK waits until an admitted task finished
+    done_num = 0;
+    {
+        gate blocker;
+        std::atomic<bool> is_submitted{false};
+        opencle::scheduler_option option;
+        option.max_pending_num = 1;
+        option.policy = opencle::admission_policy::BLOCK;
+        opencle::AMP amp{opencle::Device_Type::ALL, option};
+        amp.exec(opencle::Task{[&blocker](opencle::device const &) { blocker.wait(); }},
+                 [&done_num](std::exception_ptr) { ++done_num; });
+
+        std::thread submitter{[&]() {
+            amp.exec(opencle::Task{nothing}, [&done_num](std::exception_ptr) { ++done_num; });
+            is_submitted = true;
+        }};
+        std::this_thread::sleep_for(std::chrono::milliseconds{200});
+        assert(!is_submitted);
+        blocker.open();
+        submitter.join();
+        assert(is_submitted);
+    }
+    assert(done_num == 2);
+
+    // the bytes of the declared buffers count against max_pending_bytes
+    done_num = 0;
+    {
+        gate blocker;
+        int_buffer held(static_cast<size_t>(16));
+        int_buffer other(static_cast<size_t>(16));
+        opencle::scheduler_option option;
+        option.max_pending_num = 0;
+        option.max_pending_bytes = 16 * sizeof(int) + 1;
+        option.policy = opencle::admission_policy::REJECT;
+        opencle::AMP amp{opencle::Device_Type::ALL, option};
+
+        opencle::Task holding{[&blocker](opencle::device const &) { blocker.wait(); }};
+        holding.uses(held);
+        amp.exec(std::move(holding), [&done_num](std::exception_ptr) { ++done_num; });
+
+        opencle::Task over{nothing};
+        over.uses(other);
+        bool is_admitted = amp.try_exec(std::move(over), [&done_num](std::exception_ptr) { ++done_num; });
+        assert(!is_admitted);
+        assert(over.get_inputs().size() == 1);
+
+        // a task without buffers still fits
+        is_admitted = amp.try_exec(opencle::Task{nothing}, [&done_num](std::exception_ptr) { ++done_num; });
+        assert(is_admitted);
+        blocker.open();
+    }
+    assert(done_num == 2);
+}
+} // namespace opencle_test
+
+int main(int argc, char *argv[])
+{
+    opencle_test::test();
+    opencle_test::test_priority();
+    opencle_test::test_admission();
+    std::cout << "========== AMP test pass ==========" << std::endl;
+    return 0;
+}
@@ -4,8 +4,11 @@
 #include <stdlib.h>
 #include <string>
 #include <iostream>
+#include <cmath>
+#include <limits>
 
 #include "../util/core_def.hpp"
+#include "../device/cost_model.hpp"
 #include "../device/device_impl.hpp"
 
 // OpenCL C code
@@ -101,6 +104,8 @@ void test()
     }
 
     opencle::device_impl dev_impl{device};
+    // the context and queues are created on first use
+    assert(!dev_impl.is_initialized());
 
     // initialize and allocate device side memory
     cl_mem input_1_buf = clCreateBuffer(dev_impl.get_context(), CL_MEM_READ_ONLY, element_num * sizeof(int), NULL, &status);
@@ -108,6 +113,7 @@ void test()
     {
         throw std::runtime_error{"OpenCL runtime error: Cannot create memory buffer"};
     }
+    assert(dev_impl.is_initialized());
     cl_mem input_2_buf = clCreateBuffer(dev_impl.get_context(), CL_MEM_READ_ONLY, element_num * sizeof(int), NULL, &status);
     if (status != CL_SUCCESS)
     {
@@ -192,6 +198,56 @@ void test()
     std::cout << "compute unit available:" << dev_impl.get_compute_unit_available() << std::endl;
     assert(dev_impl.get_compute_unit_available() == cu - 5);
 
+    // queued launches make the device look slower to the selector
+    double idle_time = dev_impl.get_expected_time();
+    dev_impl.queue_depth_increment(2);
+    assert(dev_impl.get_queue_depth() == 2);
+    assert(dev_impl.get_expected_time() > idle_time);
+    dev_impl.queue_depth_increment(-2);
+    assert(dev_impl.get_outstanding_bytes() == 0);
+
+    // measured runtimes are fitted against the work items and count in the completion time
+    opencle::cost_model::set_table_path("device_impl_test_cost_model.txt");
+    dev_impl.record_runtime("vecadd", 100, 1.0);
+    dev_impl.record_runtime("vecadd", 200, 2.0);
+    dev_impl.record_runtime("vecadd", 300, 3.0);
+    assert(std::abs(dev_impl.get_runtime("vecadd", 400) - 4.0) < 1e-9);
+    assert(std::abs(dev_impl.get_runtime("vecadd") - 2.0) < 1.0);
+    assert(dev_impl.get_completion_time("vecadd", 400, 1.0) > dev_impl.get_completion_time("vecadd", 400, 0.0));
+    double idle_completion = dev_impl.get_completion_time("vecadd", 400, 0.0);
+    dev_impl.backlog_increment(1.5);
+    assert(dev_impl.get_completion_time("vecadd", 400, 0.0) > idle_completion);
+    dev_impl.backlog_increment(-1.5);
+
+    // the fit is read back after a restart
+    opencle::cost_model::save();
+    opencle::cost_model::set_table_path("device_impl_test_cost_model.txt");
+    assert(std::abs(dev_impl.get_runtime("vecadd", 400) - 4.0) < 1e-6);
+
+    // errors of the command itself do not count against the device
+    opencle::device_impl failing_impl{device};
+    for (size_t i = 0; i < opencle::device_impl::max_error_num; ++i)
+    {
+        failing_impl.report_status(CL_INVALID_VALUE);
+        failing_impl.report_status(CL_EXEC_STATUS_ERROR_FOR_EVENTS_IN_WAIT_LIST);
+    }
+    assert(failing_impl);
+    for (size_t i = 0; i < opencle::device_impl::max_error_num; ++i)
+    {
+        failing_impl.report_notification("CL_INVALID_KERNEL_ARGS error executing CL_COMMAND_NDRANGE_KERNEL");
+        failing_impl.report_notification("buffer exchange changed the reset value of a counter");
+        failing_impl.report_notification("unknown driver message");
+    }
+    assert(failing_impl);
+    failing_impl.report_notification("CL_OUT_OF_RESOURCES error executing CL_COMMAND_NDRANGE_KERNEL");
+    assert(failing_impl);
+    for (size_t i = 1; i < opencle::device_impl::max_error_num; ++i)
+    {
+        failing_impl.report_status(CL_OUT_OF_RESOURCES);
+    }
+    assert(!failing_impl);
+    assert(failing_impl.get_expected_time() == std::numeric_limits<double>::infinity());
+
     // free resources
     clReleaseKernel(kernel);
     clReleaseProgram(program);
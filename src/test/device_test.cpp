@@ -1,10 +1,12 @@
 #include <CL/cl.h>
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 #include <stdlib.h>
 #include <string>
 #include <iostream>
 
+#include "../device/device_benchmark.hpp"
 #include "../device/device_impl.hpp"
 #include "../device/device.hpp"
 #include "../memory/global_ptr_impl.hpp"
@@ -52,7 +54,24 @@ void test()
 
     std::vector<opencle::device> const &dev_vector = opencle::device::get_device_list();
 
+    opencle::device_benchmark::set_table_path("device_test_device.txt");
     opencle::device::create_device_list(opencle::device_type::ALL);
+
+    // the same arguments keep the list, other options cannot be applied to it
+    opencle::device::create_device_list(opencle::device_type::ALL);
+    opencle::device_option profiling_option;
+    profiling_option.profiling = true;
+    bool is_thrown = false;
+    try
+    {
+        opencle::device::create_device_list(opencle::device_type::ALL, profiling_option);
+    }
+    catch (std::runtime_error const &)
+    {
+        is_thrown = true;
+    }
+    assert(is_thrown);
+
     opencle::device::sort_device_list();
     opencle::device const &dev = opencle::device::get_top_device();
 
@@ -60,6 +79,32 @@ void test()
 
     assert(dev_vector[0].is_equal(dev));
 
+    // every device is benchmarked once, the second lookup hits the table
+    opencle::device_performance const &perf = dev_impl.get_performance();
+    assert(perf.is_valid());
+    assert(opencle::device_benchmark::get(&dev_impl).compute_throughput == perf.compute_throughput);
+    for (auto const &other : dev_vector)
+    {
+        assert(dev.get_device_impl()->get_expected_time() <= other.get_device_impl()->get_expected_time());
+    }
+
+    // CPU devices are split by NUMA node where the driver supports it
+    for (auto const &other : dev_vector)
+    {
+        opencle::device_impl const &other_impl = *other.get_device_impl();
+        if (other_impl.is_sub_device())
+        {
+            cl_device_id parent;
+            cl_uint parent_cu;
+            clGetDeviceInfo(other_impl.get_device_id(), CL_DEVICE_PARENT_DEVICE, sizeof(cl_device_id), &parent, NULL);
+            clGetDeviceInfo(parent, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &parent_cu, NULL);
+            assert(other_impl.get_compute_unit_total() < parent_cu);
+        }
+    }
+
+    opencle::device const &selected = opencle::device::select_device();
+    assert(std::any_of(dev_vector.begin(), dev_vector.end(), [&](auto const &d) { return d.is_equal(selected); }));
+
     // initialize and allocate device side memory
     cl_mem input_1_buf = input_1_gp.to_device(&dev_impl);
     cl_mem input_2_buf = input_2_gp.to_device(&dev_impl);
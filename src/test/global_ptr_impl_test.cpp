@@ -7,6 +7,7 @@
 
 #include "../device/device_impl.hpp"
 #include "../memory/global_ptr_impl.hpp"
+#include "../memory/host_allocator.hpp"
 #include "../util/core_def.hpp"
 
 // OpenCL C code
@@ -116,10 +117,16 @@ void test()
 
     opencle::device_impl dev_impl{device};
 
+    // read only inputs cost one upload until they are on the device, a
+    // fresh output costs nothing
+    assert(input_1_gp.get_transfer_time(&dev_impl) == dev_impl.get_upload_time(element_num * sizeof(int)));
+    assert(output_gp.get_transfer_time(&dev_impl) == 0);
+
     // initialize and allocate device side memory
     cl_mem input_1_buf = input_1_gp.to_device(&dev_impl);
     cl_mem input_2_buf = input_2_gp.to_device(&dev_impl);
     cl_mem output_buf = output_gp.to_device(&dev_impl);
+    assert(input_1_gp.get_transfer_time(&dev_impl) == 0);
 
     // initialize kernel
     cl_program program = clCreateProgramWithSource(dev_impl.get_context(), 1, &programSource, NULL, &status);
@@ -176,6 +183,12 @@ void test()
     }
     std::cout << std::endl;
 
+    // host copies follow the device's node, and stay compatible with delete[]
+    constexpr size_t placed_size = 4 * opencle::host_allocator::min_placed_size;
+    char *placed = opencle::host_allocator::allocate(placed_size, dev_impl.get_numa_node());
+    placed[0] = placed[placed_size - 1] = 1;
+    delete[] placed;
+
     // free resources
     clReleaseKernel(kernel);
     clReleaseProgram(program);
@@ -0,0 +1,107 @@
+#include <CL/cl.h>
+#include <cassert>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <iostream>
+
+#include "../device/device_impl.hpp"
+#include "../device/device.hpp"
+#include "../memory/global_ptr_impl.hpp"
+#include "../task/split_task_impl.hpp"
+#include "../util/core_def.hpp"
+
+// OpenCL C code
+std::string programSource = "__kernel \n"
+                            "void vecadd(__global int *A, __global int *B, __global int *C) \n"
+                            "{ \n"
+                            "   int idx = get_global_id(0); \n"
+                            "   C[idx] = A[idx] + B[idx]; \n"
+                            "} \n";
+
+namespace opencle_test
+{
+
+void test()
+{
+    constexpr int element_num = 1024;
+
+    // allocate space and initialize for input and output host data
+    int *input_1 = new int[element_num];
+    int *input_2 = new int[element_num];
+    int *expect = new int[element_num];
+
+    for (int i = 0; i < element_num; ++i)
+    {
+        input_1[i] = i;
+        input_2[i] = 4 * i;
+        expect[i] = 5 * i;
+    }
+
+    std::function<void(void const *)> deleter = [](void const *p) { delete[] static_cast<int const *>(p); };
+
+    opencle::global_ptr_impl input_1_gp{static_cast<void *>(input_1), element_num * sizeof(int), deleter, true};
+    opencle::global_ptr_impl input_2_gp{static_cast<void *>(input_2), element_num * sizeof(int), deleter, true};
+    opencle::global_ptr_impl output_gp{element_num * sizeof(int), false};
+
+    // slices are copied on their own queues while the kernels run on two compute queues
+    opencle::device_option option;
+    option.compute_queue_num = 2;
+    option.upload_queue_num = 1;
+    option.download_queue_num = 1;
+    option.shared_context = true;
+    opencle::device::create_device_list(opencle::device_type::ALL, option);
+
+    std::vector<opencle::device_impl *> devices;
+    for (auto const &dev : opencle::device::get_device_list())
+    {
+        devices.push_back(dev.get_device_impl().get());
+    }
+
+    // devices of one platform share their context
+    for (auto *lhs : devices)
+    {
+        for (auto *rhs : devices)
+        {
+            cl_platform_id lhs_platform, rhs_platform;
+            clGetDeviceInfo(lhs->get_device_id(), CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &lhs_platform, NULL);
+            clGetDeviceInfo(rhs->get_device_id(), CL_DEVICE_PLATFORM, sizeof(cl_platform_id), &rhs_platform, NULL);
+            assert((lhs_platform == rhs_platform) == (lhs->get_context() == rhs->get_context()));
+        }
+    }
+
+    opencle::split_task_impl vec_add_task{programSource, "vecadd"};
+    vec_add_task.compile(devices);
+
+    vec_add_task.set_arg_buffer(0, &input_1_gp, opencle::split_access::SLICE_IN, sizeof(int));
+    vec_add_task.set_arg_buffer(1, &input_2_gp, opencle::split_access::SLICE_IN, sizeof(int));
+    vec_add_task.set_arg_buffer(2, &output_gp, opencle::split_access::SLICE_OUT, sizeof(int));
+
+    size_t index_space_size[1];
+    size_t work_group_size[1];
+    index_space_size[0] = element_num;
+    work_group_size[0] = 16;
+
+    // the second run is weighted by the throughput measured in the first one
+    vec_add_task.exec(1, index_space_size, work_group_size);
+    vec_add_task.exec(1, index_space_size, work_group_size, opencle::split_weight::THROUGHPUT);
+
+    int *output = reinterpret_cast<int *>(output_gp.get());
+
+    for (int i = 0; i < element_num; ++i)
+    {
+        assert(expect[i] == output[i]);
+    }
+
+    // free resources
+
+    delete[] expect;
+}
+} // namespace opencle_test
+
+int main(int argc, char *argv[])
+{
+    opencle_test::test();
+    std::cout << "========== split_task_impl test pass ==========" << std::endl;
+    return 0;
+}
@@ -3,12 +3,16 @@
 #include <stdexcept>
 #include <stdlib.h>
 #include <string>
+#include <vector>
 #include <iostream>
 
 #include "../device/device_impl.hpp"
 #include "../memory/global_ptr_impl.hpp"
 #include "../task/task_impl.hpp"
+#include "../task/work_size_tuner.hpp"
 #include "../util/core_def.hpp"
+#include "../util/metrics/metrics.hpp"
+#include "../util/profiler/profiler.hpp"
 
 // OpenCL C code
 std::string programSource = "__kernel \n"
@@ -18,6 +22,15 @@ std::string programSource = "__kernel \n"
                             "   C[idx] = A[idx] + B[idx]; \n"
                             "} \n";
 
+// bound-checked against the real size passed in the trailing argument
+std::string paddedSource = "__kernel \n"
+                           "void vecadd_padded(__global int *A, __global int *B, __global int *C, ulong n) \n"
+                           "{ \n"
+                           "   size_t idx = get_global_id(0); \n"
+                           "   if (idx < n) \n"
+                           "      C[idx] = A[idx] + B[idx]; \n"
+                           "} \n";
+
 namespace opencle_test
 {
 
@@ -110,7 +123,9 @@ void test()
         throw std::runtime_error{"OpenCL runtime error: Cannot get device info"};
     }
 
-    opencle::device_impl dev_impl{device};
+    opencle::device_option option;
+    option.profiling = true;
+    opencle::device_impl dev_impl{device, option};
 
     // initialize and allocate device side memory
     cl_mem input_1_buf = input_1_gp.to_device(&dev_impl);
@@ -128,13 +143,63 @@ void test()
 
     vec_add_task.set_args(std::move(args));
 
+    // every launch below starts from a poisoned output, so it has to write each element itself
+    std::vector<int> poison(element_num, -1);
+    auto poison_output = [&]() {
+        status = clEnqueueWriteBuffer(dev_impl.get_command_queue(), output_buf, CL_TRUE, 0, element_num * sizeof(int),
+                                      poison.data(), 0, NULL, NULL);
+        assert(status == CL_SUCCESS);
+    };
+    auto check_output = [&]() {
+        std::vector<int> result(element_num);
+        status = clEnqueueReadBuffer(dev_impl.get_command_queue(), output_buf, CL_TRUE, 0, element_num * sizeof(int),
+                                     result.data(), 0, NULL, NULL);
+        assert(status == CL_SUCCESS);
+        for (int i = 0; i < element_num; ++i)
+        {
+            assert(expect[i] == result[i]);
+        }
+    };
+
     // enqueue kernel
     size_t index_space_size[1];
     size_t work_group_size[1];
     index_space_size[0] = element_num;
     work_group_size[0] = 4;
 
+    poison_output();
     vec_add_task.exec(1, index_space_size, work_group_size);
+    check_output();
+
+    // autotuned local size, the second call hits the work size table
+    opencle::work_size_tuner::set_table_path("task_impl_test_work_size.txt");
+    vec_add_task.set_idempotent(true);
+    poison_output();
+    vec_add_task.exec(1, index_space_size);
+    check_output();
+    poison_output();
+    vec_add_task.exec(1, index_space_size);
+    check_output();
+
+    // 16 work items with work group of 5, bulk of 15 and a remainder of 1
+    size_t odd_group_size[1] = {5};
+    poison_output();
+    vec_add_task.exec(1, index_space_size, odd_group_size, opencle::launch_mode::REMAINDER);
+    check_output();
+
+    // 16 work items padded to 20, the kernel drops the 4 past the real size
+    opencle::task_impl padded_task{paddedSource, "vecadd_padded"};
+    padded_task.compile(&dev_impl);
+
+    std::vector<std::pair<size_t, void *>> padded_args{
+        std::pair<size_t, void *>{sizeof(cl_mem), static_cast<void *>(&input_1_buf)},
+        std::pair<size_t, void *>{sizeof(cl_mem), static_cast<void *>(&input_2_buf)},
+        std::pair<size_t, void *>{sizeof(cl_mem), static_cast<void *>(&output_buf)}};
+
+    padded_task.set_args(std::move(padded_args));
+
+    poison_output();
+    padded_task.exec(1, index_space_size, odd_group_size, opencle::launch_mode::PADDED);
 
     int *output = reinterpret_cast<int *>(output_gp.release());
 
@@ -145,6 +210,19 @@ void test()
     }
     std::cout << std::endl;
 
+    // one sample per launch, the release reads the output back once
+    auto kernel_stats = opencle::profiler::get_kernel_stats();
+    assert(kernel_stats["vecadd"].count >= 4);
+    opencle::profile_stats download_stats = opencle::profiler::get_transfer_stats(opencle::transfer_direction::DOWNLOAD);
+    assert(download_stats.count == 1);
+    assert(download_stats.bytes == element_num * sizeof(int));
+    opencle::profiler::dump(std::cout);
+
+    opencle::metrics::snapshot values = opencle::metrics::get_snapshot();
+    assert(values.counters["opencle_kernel_launches_total"] >= 4);
+    assert(values.counters["opencle_download_bytes_total"] == element_num * sizeof(int));
+    opencle::metrics::dump(std::cout);
+
     // free resources
 
     delete[] expect;
@@ -0,0 +1,140 @@
+#include <CL/cl.h>
+#include <cassert>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "../device/device.hpp"
+#include "../memory/global_ptr.hpp"
+#include "../task/task.hpp"
+#include "../util/core_def.hpp"
+#include "../util/trace/trace.hpp"
+
+// OpenCL C code
+std::string programSource = "#ifndef SCALE \n"
+                            "#define SCALE k \n"
+                            "#endif \n"
+                            "__kernel \n"
+                            "void vecadd_scale(__global int *A, __global int *B, __global int *C, int k, __local int *tmp) \n"
+                            "{ \n"
+                            "   int idx = get_global_id(0); \n"
+                            "   tmp[get_local_id(0)] = A[idx] + B[idx]; \n"
+                            "   C[idx] = SCALE * tmp[get_local_id(0)]; \n"
+                            "} \n";
+
+namespace opencle_test
+{
+
+void test()
+{
+    constexpr int element_num = 16;
+
+    // allocate space and initialize for input and output host data
+    int *input_1_host = new int[element_num];
+    int *input_2_host = new int[element_num];
+    int *expect = new int[element_num];
+
+    for (int i = 0; i < element_num; ++i)
+    {
+        input_1_host[i] = i;
+        input_2_host[i] = 4 * i;
+        expect[i] = 3 * 5 * i;
+    }
+
+    opencle::global_ptr<int[]> input_1(input_1_host, element_num);
+    opencle::global_ptr<int[]> input_2(input_2_host, element_num);
+    opencle::global_ptr<int[]> output(static_cast<size_t>(element_num));
+
+    // launches are ordered by buffer events, so the typed task runs on out-of-order queues as well
+    opencle::device::create_device_list(opencle::device_type::ALL, opencle::device_option{true});
+    opencle::device const &dev = opencle::device::get_top_device();
+
+    using int_buffer = opencle::global_ptr<int[]>;
+    opencle::task<int_buffer, int_buffer, int_buffer, int, opencle::local_memory<int>> vec_add_task{programSource,
+                                                                                                   "vecadd_scale"};
+    opencle::trace::enable();
+    vec_add_task.compile(dev);
+
+    // enqueue kernel
+    size_t index_space_size[1];
+    size_t work_group_size[1];
+    index_space_size[0] = element_num;
+    work_group_size[0] = 4;
+
+    vec_add_task.exec(1, index_space_size, work_group_size, input_1, input_2, output, 3,
+                      opencle::local_memory<int>{4});
+
+    for (int i = 0; i < element_num; ++i)
+    {
+        std::cout << output[i] << ", ";
+        assert(expect[i] == output[i]);
+    }
+    std::cout << std::endl;
+
+    // bake the scale in as a constant, the runtime argument is ignored
+    vec_add_task.specialize("SCALE", 3);
+    vec_add_task.set_build_options("-cl-mad-enable");
+    vec_add_task.compile(dev);
+    vec_add_task.exec(1, index_space_size, work_group_size, input_1, input_2, output, 0,
+                      opencle::local_memory<int>{4});
+
+    for (int i = 0; i < element_num; ++i)
+    {
+        assert(expect[i] == output[i]);
+    }
+
+    // the output stays on the device, the second launch waits for the first by its event
+    opencle::global_ptr<int[]> chained(static_cast<size_t>(element_num));
+    vec_add_task.exec(1, index_space_size, work_group_size, input_1, input_2, output, 0,
+                      opencle::local_memory<int>{4});
+    vec_add_task.exec(1, index_space_size, work_group_size, output, input_2, chained, 0,
+                      opencle::local_memory<int>{4});
+    for (int i = 0; i < element_num; ++i)
+    {
+        assert(3 * (expect[i] + input_2_host[i]) == chained[i]);
+    }
+
+    // the same task from several threads, each launch checks out its own kernel
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([&, t]() {
+            opencle::global_ptr<int[]> in_1(input_1_host, element_num);
+            opencle::global_ptr<int[]> in_2(input_2_host, element_num);
+            opencle::global_ptr<int[]> out(static_cast<size_t>(element_num));
+            vec_add_task.exec(1, index_space_size, work_group_size, in_1, in_2, out, t,
+                              opencle::local_memory<int>{4});
+            for (int i = 0; i < element_num; ++i)
+            {
+                assert(expect[i] == out[i]);
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+
+    std::ostringstream timeline;
+    opencle::trace::dump(timeline);
+    assert(timeline.str().find("\"name\":\"vecadd_scale\",\"cat\":\"exec\"") != std::string::npos);
+    assert(timeline.str().find("\"name\":\"to_device\"") != std::string::npos);
+
+    // free resources
+
+    delete[] input_1_host;
+    delete[] input_2_host;
+    delete[] expect;
+}
+} // namespace opencle_test
+
+int main(int argc, char *argv[])
+{
+    opencle_test::test();
+    std::cout << "========== task test pass ==========" << std::endl;
+    return 0;
+}
@@ -0,0 +1,343 @@
+#include "logger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <streambuf>
+#include <strings.h>
+#include <thread>
+#include <vector>
+
+namespace
+{
+constexpr size_t ring_size = 1024;
+
+// messages built while the arguments of another one are formatted, e.g. a
+// logging accessor called in a logger_warn; deeper ones are dropped
+constexpr size_t max_nesting_num = 4;
+constexpr auto drain_interval = std::chrono::milliseconds{5};
+
+char const *const __level_names[] = {"TRACE", "DEBUG", "INFO", "WARN", "ERROR", "OFF"};
+
+struct message
+{
+    int64_t time;
+    opencle::log_level level;
+    char const *file;
+    int line;
+    size_t size;
+    char text[opencle::logging::max_message_size];
+};
+
+/** Single producer, single consumer ring, the owning thread writes at
+ * 'head' and the writer thread reads at 'tail'. When the thread exits, the
+ * ring passes to the next thread that logs, messages not written yet stay
+ * ahead of the new ones. */
+struct ring
+{
+    size_t thread_index;
+    std::atomic<size_t> head{0};
+    std::atomic<size_t> tail{0};
+    std::atomic<size_t> dropped{0};
+    message slots[ring_size];
+};
+
+/** Writes into a fixed slot, output past the end is truncated. */
+class slot_buffer final : public std::streambuf
+{
+public:
+    void reset(char *begin, char *end)
+    {
+        setp(begin, end);
+    }
+
+    size_t size() const
+    {
+        return static_cast<size_t>(pptr() - pbase());
+    }
+};
+
+struct log_state
+{
+    std::mutex rings_mutex;
+    std::vector<std::shared_ptr<ring>> rings;
+    // rings of exited threads, still drained until they are taken again
+    std::vector<std::shared_ptr<ring>> idle_rings;
+
+    // serializes draining between the writer thread and flush()
+    std::mutex drain_mutex;
+    std::ofstream file;
+    std::ostream *out = &std::clog;
+
+    std::mutex thread_mutex;
+    std::condition_variable thread_cv;
+    bool is_stopped = false;
+    std::thread writer;
+
+    std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    log_state();
+    ~log_state();
+
+    void drain();
+};
+
+// set when the state is destroyed, threads exiting later keep their ring
+std::atomic<bool> __is_state_destroyed{false};
+
+log_state &__get_state()
+{
+    static log_state state;
+    return state;
+}
+
+log_state::log_state()
+{
+    writer = std::thread{[this]() {
+        std::unique_lock<std::mutex> lock{thread_mutex};
+        while (!is_stopped)
+        {
+            thread_cv.wait_for(lock, drain_interval);
+            lock.unlock();
+            drain();
+            lock.lock();
+        }
+    }};
+}
+
+log_state::~log_state()
+{
+    {
+        std::lock_guard<std::mutex> lock{thread_mutex};
+        is_stopped = true;
+    }
+    thread_cv.notify_all();
+    writer.join();
+    drain();
+
+    // static destructors and exit handlers that run later must not log
+    opencle::logging::set_level(opencle::log_level::OFF);
+    __is_state_destroyed = true;
+}
+
+void log_state::drain()
+{
+    std::lock_guard<std::mutex> drain_lock{drain_mutex};
+    std::vector<std::shared_ptr<ring>> snapshot;
+    {
+        std::lock_guard<std::mutex> lock{rings_mutex};
+        snapshot = rings;
+    }
+
+    std::vector<std::pair<message const *, size_t>> batch;
+    std::vector<std::pair<size_t, size_t>> ends;
+    for (auto &r : snapshot)
+    {
+        size_t tail = r->tail.load(std::memory_order_relaxed);
+        size_t head = r->head.load(std::memory_order_acquire);
+        for (size_t i = tail; i < head; ++i)
+        {
+            batch.emplace_back(&r->slots[i % ring_size], r->thread_index);
+        }
+        ends.emplace_back(head, r->thread_index);
+
+        size_t dropped = r->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0)
+        {
+            *out << "[opencle] thread " << r->thread_index << " dropped " << dropped << " log messages\n";
+        }
+    }
+
+    // each ring is in order already, merge the threads by time
+    std::stable_sort(batch.begin(), batch.end(),
+                     [](auto const &lhs, auto const &rhs) { return lhs.first->time < rhs.first->time; });
+    for (auto const &entry : batch)
+    {
+        message const &m = *entry.first;
+        *out << "[" << m.time << "us " << __level_names[static_cast<int>(m.level)] << " #" << entry.second << " "
+             << m.file << ":" << m.line << "] ";
+        out->write(m.text, m.size);
+        *out << "\n";
+    }
+    if (!batch.empty())
+    {
+        out->flush();
+    }
+
+    // slots are handed back only after they are written
+    for (size_t i = 0; i < snapshot.size(); ++i)
+    {
+        snapshot[i]->tail.store(ends[i].first, std::memory_order_release);
+    }
+}
+
+/** A message being formatted, copied into the ring on commit. */
+struct frame
+{
+    message m;
+    slot_buffer buffer;
+    std::ostream stream{&buffer};
+};
+
+// set when the producer of the thread is destroyed, e.g. for static
+// destructors of the main thread; trivially destructible, so still readable
+thread_local bool __is_producer_destroyed = false;
+
+struct producer
+{
+    std::shared_ptr<ring> r;
+    frame frames[max_nesting_num];
+    frame overflow;
+    size_t depth = 0;
+
+    producer()
+    {
+        log_state &state = __get_state();
+        std::lock_guard<std::mutex> lock{state.rings_mutex};
+        if (!state.idle_rings.empty())
+        {
+            r = std::move(state.idle_rings.back());
+            state.idle_rings.pop_back();
+            return;
+        }
+        r = std::make_shared<ring>();
+        r->thread_index = state.rings.size();
+        state.rings.push_back(r);
+    }
+
+    ~producer()
+    {
+        __is_producer_destroyed = true;
+        if (!__is_state_destroyed)
+        {
+            log_state &state = __get_state();
+            std::lock_guard<std::mutex> lock{state.rings_mutex};
+            state.idle_rings.push_back(std::move(r));
+        }
+    }
+};
+
+producer &__get_producer()
+{
+    thread_local producer p;
+    return p;
+}
+
+// formats the messages of a thread whose producer is gone, never destroyed
+frame &__get_discard_frame()
+{
+    thread_local frame *discard = new frame;
+    return *discard;
+}
+} // namespace
+
+namespace opencle
+{
+// constant initialized, so logging during static initialization sees a level
+std::atomic<int> logging::level_ = static_cast<int>(log_level::WARN);
+
+void logging::set_level(log_level level)
+{
+    level_ = static_cast<int>(level);
+}
+
+log_level logging::get_level()
+{
+    return static_cast<log_level>(level_.load());
+}
+
+void logging::set_output(std::string const &path)
+{
+    log_state &state = __get_state();
+    std::lock_guard<std::mutex> lock{state.drain_mutex};
+    state.file.close();
+    state.file.open(path, std::ios::app);
+    state.out = state.file ? static_cast<std::ostream *>(&state.file) : &std::clog;
+}
+
+void logging::flush()
+{
+    __get_state().drain();
+}
+
+std::ostream &logging::begin(log_level level, char const *file, int line)
+{
+    frame *f;
+    if (__is_producer_destroyed)
+    {
+        f = &__get_discard_frame();
+    }
+    else
+    {
+        producer &p = __get_producer();
+        f = p.depth < max_nesting_num ? &p.frames[p.depth] : &p.overflow;
+        ++p.depth;
+    }
+
+    f->m.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() -
+                                                                      __get_state().origin)
+                    .count();
+    f->m.level = level;
+    f->m.file = file;
+    f->m.line = line;
+
+    f->buffer.reset(f->m.text, f->m.text + max_message_size);
+    f->stream.clear();
+    return f->stream;
+}
+
+void logging::commit()
+{
+    if (__is_producer_destroyed)
+    {
+        return;
+    }
+    producer &p = __get_producer();
+    --p.depth;
+    if (p.depth >= max_nesting_num)
+    {
+        p.r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // the slot is only written here, so a nested message cannot reuse it
+    size_t head = p.r->head.load(std::memory_order_relaxed);
+    size_t tail = p.r->tail.load(std::memory_order_acquire);
+    if (head - tail == ring_size)
+    {
+        p.r->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    frame &f = p.frames[p.depth];
+    message &slot = p.r->slots[head % ring_size];
+    slot.time = f.m.time;
+    slot.level = f.m.level;
+    slot.file = f.m.file;
+    slot.line = f.m.line;
+    slot.size = f.buffer.size();
+    std::memcpy(slot.text, f.m.text, slot.size);
+    p.r->head.store(head + 1, std::memory_order_release);
+}
+} // namespace opencle
+
+namespace
+{
+bool const __is_level_set = []() {
+    char const *name = std::getenv("OPENCLE_LOG_LEVEL");
+    for (int i = 0; name && i <= static_cast<int>(opencle::log_level::OFF); ++i)
+    {
+        if (strcasecmp(name, __level_names[i]) == 0)
+        {
+            opencle::logging::set_level(static_cast<opencle::log_level>(i));
+            return true;
+        }
+    }
+    return false;
+}();
+} // namespace
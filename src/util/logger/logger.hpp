@@ -1,13 +1,77 @@
-#include <iomanip>
-#include <iostream>
-#include <sstream>
+#pragma once
+
+#include <atomic>
+#include <ostream>
+#include <string>
 
 #include "../core_def.hpp"
 
-#ifndef NDEBUG
-#define logger(msg)                                                            \
-    std::cout << "[" << std::left << std::setw(20) << __FILE__ << ", "         \
-              << std::setw(4) << __LINE__ << "] " << std::right << msg << std::endl;
-#else
-#define logger(msg)
-#endif
\ No newline at end of file
+namespace opencle
+{
+class logging;
+
+enum class log_level
+{
+    TRACE,
+    DEBUG,
+    INFO,
+    WARN,
+    ERROR,
+    OFF
+};
+
+/** Leveled asynchronous log. A message is formatted into a buffer of the
+ * calling thread, copied into a ring owned by that thread on commit and
+ * written out by a background thread, so the caller never blocks on I/O;
+ * when its ring is full the message is dropped and counted. Messages
+ * logged while the arguments of another are formatted are kept. A disabled level costs one relaxed load.
+ * The level defaults to $OPENCLE_LOG_LEVEL (trace, debug, info, warn,
+ * error or off), or warn if it is not set. */
+class logging final
+{
+public:
+    static constexpr size_t max_message_size = 240;
+
+private:
+    static std::atomic<int> level_;
+
+public:
+    logging() = delete;
+
+    static bool is_enabled(log_level level)
+    {
+        return static_cast<int>(level) >= level_.load(std::memory_order_relaxed);
+    }
+
+    static void set_level(log_level level);
+    static log_level get_level();
+
+    /** Messages go to std::clog unless an output file is set. */
+    static void set_output(std::string const &path);
+
+    /** Block until every message logged so far is written. */
+    static void flush();
+
+    /** Stream of a message of the calling thread. Only used through the
+     * macros below, between begin() and commit(), which may nest. */
+    static std::ostream &begin(log_level level, char const *file, int line);
+    static void commit();
+};
+} // namespace opencle
+
+#define logger_at(level, msg)                                                                                          \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        if (opencle::logging::is_enabled(level))                                                                       \
+        {                                                                                                              \
+            opencle::logging::begin(level, __FILE__, __LINE__) << msg;                                                 \
+            opencle::logging::commit();                                                                                \
+        }                                                                                                              \
+    } while (0)
+
+// function entry and internal steps
+#define logger(msg) logger_at(opencle::log_level::TRACE, msg)
+#define logger_debug(msg) logger_at(opencle::log_level::DEBUG, msg)
+#define logger_info(msg) logger_at(opencle::log_level::INFO, msg)
+#define logger_warn(msg) logger_at(opencle::log_level::WARN, msg)
+#define logger_error(msg) logger_at(opencle::log_level::ERROR, msg)
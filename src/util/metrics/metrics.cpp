@@ -0,0 +1,225 @@
+#include "metrics.hpp"
+
+#include <algorithm>
+#include <set>
+
+#include "../logger/logger.hpp"
+
+namespace
+{
+std::atomic<size_t> __next_shard_index{0};
+
+std::string __get_name(std::string const &key)
+{
+    return key.substr(0, key.find('{'));
+}
+
+// merges the extra label into the label set of 'key'
+std::string __add_label(std::string const &key, std::string const &extra)
+{
+    size_t brace = key.find('{');
+    if (brace == std::string::npos)
+    {
+        return key + "{" + extra + "}";
+    }
+    return key.substr(0, key.size() - 1) + "," + extra + "}";
+}
+
+std::string __with_suffix(std::string const &key, std::string const &suffix)
+{
+    size_t brace = key.find('{');
+    if (brace == std::string::npos)
+    {
+        return key + suffix;
+    }
+    return key.substr(0, brace) + suffix + key.substr(brace);
+}
+
+void __print_type(std::ostream &out, std::set<std::string> &printed, std::map<std::string, std::string> const &help,
+                  std::string const &name, char const *type)
+{
+    if (printed.insert(name).second)
+    {
+        auto it = help.find(name);
+        if (it != help.end())
+        {
+            out << "# HELP " << name << " " << it->second << "\n";
+        }
+        out << "# TYPE " << name << " " << type << "\n";
+    }
+}
+} // namespace
+
+namespace opencle
+{
+size_t metrics_detail::get_shard_index()
+{
+    thread_local size_t index = __next_shard_index.fetch_add(1, std::memory_order_relaxed) % shard_num;
+    return index;
+}
+
+uint64_t counter::value() const
+{
+    uint64_t sum = 0;
+    for (auto const &s : shards_)
+    {
+        sum = sum + s.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void histogram::observe(uint64_t sample)
+{
+    size_t bucket = 0;
+    while (bucket + 1 < bucket_num && (static_cast<uint64_t>(1) << bucket) < sample)
+    {
+        ++bucket;
+    }
+    shard &s = shards_[metrics_detail::get_shard_index()];
+    s.buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    s.count.fetch_add(1, std::memory_order_relaxed);
+    s.sum.fetch_add(sample, std::memory_order_relaxed);
+}
+
+histogram::snapshot histogram::value() const
+{
+    snapshot result;
+    for (auto const &s : shards_)
+    {
+        for (size_t i = 0; i < bucket_num; ++i)
+        {
+            result.buckets[i] = result.buckets[i] + s.buckets[i].load(std::memory_order_relaxed);
+        }
+        result.count = result.count + s.count.load(std::memory_order_relaxed);
+        result.sum = result.sum + s.sum.load(std::memory_order_relaxed);
+    }
+    return result;
+}
+
+std::mutex metrics::mutex_ = std::mutex{};
+std::map<std::string, std::string> metrics::help_ = std::map<std::string, std::string>{};
+std::map<std::string, std::unique_ptr<counter>> metrics::counters_ =
+    std::map<std::string, std::unique_ptr<counter>>{};
+std::map<std::string, std::unique_ptr<gauge>> metrics::gauges_ = std::map<std::string, std::unique_ptr<gauge>>{};
+std::map<std::string, std::unique_ptr<histogram>> metrics::histograms_ =
+    std::map<std::string, std::unique_ptr<histogram>>{};
+
+std::string metrics::make_key(std::string const &name, std::string const &labels)
+{
+    return labels.empty() ? name : name + "{" + labels + "}";
+}
+
+std::string metrics::label(std::string const &key, std::string const &value)
+{
+    std::string escaped;
+    for (char c : value)
+    {
+        if (c == '\\' || c == '"')
+        {
+            escaped.push_back('\\');
+        }
+        if (c == '\n')
+        {
+            escaped += "\\n";
+            continue;
+        }
+        escaped.push_back(c);
+    }
+    return key + "=\"" + escaped + "\"";
+}
+
+counter &metrics::get_counter(std::string const &name, std::string const &help, std::string const &labels)
+{
+    logger("get_counter(std::string const &, std::string const &, std::string const &)");
+    std::lock_guard<std::mutex> lock{mutex_};
+    help_.emplace(name, help);
+    auto &entry = counters_[make_key(name, labels)];
+    if (!entry)
+    {
+        entry = std::make_unique<counter>();
+    }
+    return *entry;
+}
+
+gauge &metrics::get_gauge(std::string const &name, std::string const &help, std::string const &labels)
+{
+    logger("get_gauge(std::string const &, std::string const &, std::string const &)");
+    std::lock_guard<std::mutex> lock{mutex_};
+    help_.emplace(name, help);
+    auto &entry = gauges_[make_key(name, labels)];
+    if (!entry)
+    {
+        entry = std::make_unique<gauge>();
+    }
+    return *entry;
+}
+
+histogram &metrics::get_histogram(std::string const &name, std::string const &help, std::string const &labels)
+{
+    logger("get_histogram(std::string const &, std::string const &, std::string const &)");
+    std::lock_guard<std::mutex> lock{mutex_};
+    help_.emplace(name, help);
+    auto &entry = histograms_[make_key(name, labels)];
+    if (!entry)
+    {
+        entry = std::make_unique<histogram>();
+    }
+    return *entry;
+}
+
+metrics::snapshot metrics::get_snapshot()
+{
+    std::lock_guard<std::mutex> lock{mutex_};
+    snapshot result;
+    for (auto const &entry : counters_)
+    {
+        result.counters[entry.first] = entry.second->value();
+    }
+    for (auto const &entry : gauges_)
+    {
+        result.gauges[entry.first] = entry.second->value();
+    }
+    for (auto const &entry : histograms_)
+    {
+        result.histograms[entry.first] = entry.second->value();
+    }
+    return result;
+}
+
+void metrics::dump(std::ostream &out)
+{
+    snapshot values = get_snapshot();
+    std::map<std::string, std::string> help;
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        help = help_;
+    }
+
+    // keys are sorted, so the series of one name are next to each other
+    std::set<std::string> printed;
+    for (auto const &entry : values.counters)
+    {
+        __print_type(out, printed, help, __get_name(entry.first), "counter");
+        out << entry.first << " " << entry.second << "\n";
+    }
+    for (auto const &entry : values.gauges)
+    {
+        __print_type(out, printed, help, __get_name(entry.first), "gauge");
+        out << entry.first << " " << entry.second << "\n";
+    }
+    for (auto const &entry : values.histograms)
+    {
+        __print_type(out, printed, help, __get_name(entry.first), "histogram");
+        std::string bucket_key = __with_suffix(entry.first, "_bucket");
+        uint64_t cumulative = 0;
+        for (size_t i = 0; i < histogram::bucket_num; ++i)
+        {
+            cumulative = cumulative + entry.second.buckets[i];
+            std::string le = i + 1 == histogram::bucket_num ? "+Inf" : std::to_string(static_cast<uint64_t>(1) << i);
+            out << __add_label(bucket_key, "le=\"" + le + "\"") << " " << cumulative << "\n";
+        }
+        out << __with_suffix(entry.first, "_sum") << " " << entry.second.sum << "\n";
+        out << __with_suffix(entry.first, "_count") << " " << entry.second.count << "\n";
+    }
+}
+} // namespace opencle
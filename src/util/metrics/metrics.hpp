@@ -0,0 +1,141 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "../core_def.hpp"
+
+namespace opencle
+{
+class metrics;
+class counter;
+class gauge;
+class histogram;
+
+namespace metrics_detail
+{
+// increments from different threads land on different cache lines
+constexpr size_t shard_num = 16;
+
+size_t get_shard_index();
+} // namespace metrics_detail
+
+/** Monotonic count, e.g. bytes moved or kernels launched. */
+class counter final
+{
+private:
+    struct alignas(64) shard
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    std::array<shard, metrics_detail::shard_num> shards_;
+
+public:
+    void add(uint64_t n = 1)
+    {
+        shards_[metrics_detail::get_shard_index()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    uint64_t value() const;
+};
+
+/** Value that goes up and down, e.g. commands in flight. */
+class gauge final
+{
+private:
+    std::atomic<int64_t> value_{0};
+
+public:
+    void add(int64_t n)
+    {
+        value_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    void set(int64_t n)
+    {
+        value_.store(n, std::memory_order_relaxed);
+    }
+
+    int64_t value() const
+    {
+        return value_.load(std::memory_order_relaxed);
+    }
+};
+
+/** Distribution of positive samples in power of two buckets, bucket i
+ * counts samples up to 2^i. Samples are usually microseconds or bytes. */
+class histogram final
+{
+public:
+    static constexpr size_t bucket_num = 40;
+
+    struct snapshot
+    {
+        std::array<uint64_t, bucket_num> buckets{};
+        uint64_t count = 0;
+        uint64_t sum = 0;
+    };
+
+private:
+    struct alignas(64) shard
+    {
+        std::array<std::atomic<uint64_t>, bucket_num> buckets{};
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> sum{0};
+    };
+
+    std::array<shard, metrics_detail::shard_num> shards_;
+
+public:
+    void observe(uint64_t sample);
+    snapshot value() const;
+};
+
+/** Process wide registry of named metrics, exposed in the Prometheus text
+ * format. Looking a metric up takes a lock, so call sites keep the returned
+ * reference, e.g. in a function-local static; updating it is lock-free.
+ * 'labels' is the inner part of a label set, e.g. device="Tesla_K80". */
+class metrics final
+{
+public:
+    struct snapshot
+    {
+        std::map<std::string, uint64_t> counters;
+        std::map<std::string, int64_t> gauges;
+        std::map<std::string, histogram::snapshot> histograms;
+    };
+
+private:
+    // a metric is keyed by name{labels}, the help text is kept per name
+    static std::mutex mutex_;
+    static std::map<std::string, std::string> help_;
+    static std::map<std::string, std::unique_ptr<counter>> counters_;
+    static std::map<std::string, std::unique_ptr<gauge>> gauges_;
+    static std::map<std::string, std::unique_ptr<histogram>> histograms_;
+
+    static std::string make_key(std::string const &name, std::string const &labels);
+
+public:
+    metrics() = delete;
+
+    static counter &get_counter(std::string const &name, std::string const &help, std::string const &labels = "");
+    static gauge &get_gauge(std::string const &name, std::string const &help, std::string const &labels = "");
+    static histogram &get_histogram(std::string const &name, std::string const &help,
+                                    std::string const &labels = "");
+
+    /** Quote and escape a label value, e.g. label("device", id). */
+    static std::string label(std::string const &key, std::string const &value);
+
+    static snapshot get_snapshot();
+
+    /** Text exposition format, ready to be served over a file or socket. */
+    static void dump(std::ostream &out);
+};
+} // namespace opencle
@@ -0,0 +1,170 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+
+#include "../../device/device_impl.hpp"
+#include "../logger/logger.hpp"
+
+namespace
+{
+double __get_elapsed(cl_ulong begin, cl_ulong end)
+{
+    return end > begin ? static_cast<double>(end - begin) * 1e-9 : 0;
+}
+
+size_t __get_histogram_bucket(double seconds)
+{
+    size_t us = static_cast<size_t>(seconds * 1e6);
+    size_t bucket = 0;
+    while (us > 0 && bucket + 1 < opencle::profile_stats::histogram_bucket_num)
+    {
+        us = us >> 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+void __print_stats(std::ostream &out, std::string const &name, opencle::profile_stats const &stats)
+{
+    out << std::left << std::setw(24) << name << std::right << " count " << std::setw(8) << stats.count << "  mean "
+        << std::setw(10) << stats.get_mean_exec_time() * 1e6 << "us  max " << std::setw(10)
+        << stats.max_exec_time * 1e6 << "us  queued " << std::setw(10) << stats.queue_time * 1e6 << "us  submitted "
+        << std::setw(10) << stats.submit_time * 1e6 << "us";
+    if (stats.bytes > 0)
+    {
+        out << "  " << stats.bytes << " bytes  " << stats.get_bandwidth() / 1e9 << " GB/s";
+    }
+    out << "\n";
+}
+} // namespace
+
+namespace opencle
+{
+double profile_stats::get_mean_exec_time() const
+{
+    return count > 0 ? exec_time / count : 0;
+}
+
+double profile_stats::get_bandwidth() const
+{
+    return exec_time > 0 ? bytes / exec_time : 0;
+}
+
+std::mutex profiler::mutex_ = std::mutex{};
+std::condition_variable profiler::pending_cv_ = std::condition_variable{};
+size_t profiler::pending_num_ = 0;
+std::map<std::string, profile_stats> profiler::kernel_stats_ = std::map<std::string, profile_stats>{};
+std::map<transfer_direction, profile_stats> profiler::transfer_stats_ = std::map<transfer_direction, profile_stats>{};
+
+void profiler::on_complete(cl_event event, cl_int status, void *user_data)
+{
+    record *rec = static_cast<record *>(user_data);
+
+    cl_ulong queued = 0, submit = 0, start = 0, end = 0;
+    bool is_valid = status == CL_COMPLETE;
+    is_valid = is_valid && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_QUEUED, sizeof(cl_ulong), &queued,
+                                                   NULL) == CL_SUCCESS;
+    is_valid = is_valid && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_SUBMIT, sizeof(cl_ulong), &submit,
+                                                   NULL) == CL_SUCCESS;
+    is_valid = is_valid && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(cl_ulong), &start,
+                                                   NULL) == CL_SUCCESS;
+    is_valid = is_valid && clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(cl_ulong), &end,
+                                                   NULL) == CL_SUCCESS;
+
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        if (is_valid)
+        {
+            profile_stats &stats = rec->is_transfer ? transfer_stats_[rec->direction] : kernel_stats_[rec->name];
+            double exec_time = __get_elapsed(start, end);
+            stats.count = stats.count + 1;
+            stats.bytes = stats.bytes + rec->bytes;
+            stats.queue_time = stats.queue_time + __get_elapsed(queued, submit);
+            stats.submit_time = stats.submit_time + __get_elapsed(submit, start);
+            stats.exec_time = stats.exec_time + exec_time;
+            stats.max_exec_time = std::max(stats.max_exec_time, exec_time);
+            ++stats.histogram[__get_histogram_bucket(exec_time)];
+        }
+        --pending_num_;
+    }
+    pending_cv_.notify_all();
+    delete rec;
+}
+
+void profiler::add(record *rec, cl_event event)
+{
+    {
+        std::lock_guard<std::mutex> lock{mutex_};
+        ++pending_num_;
+    }
+    if (clSetEventCallback(event, CL_COMPLETE, on_complete, rec) != CL_SUCCESS)
+    {
+        logger_warn("Cannot set profiling callback on event " << event);
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            --pending_num_;
+        }
+        pending_cv_.notify_all();
+        delete rec;
+    }
+}
+
+void profiler::wait_pending(std::unique_lock<std::mutex> &lock)
+{
+    pending_cv_.wait(lock, []() { return pending_num_ == 0; });
+}
+
+void profiler::record_kernel(device_impl const *dev, std::string const &name, cl_event event)
+{
+    if (dev->is_profiling())
+    {
+        add(new record{name, false, transfer_direction::UPLOAD, 0}, event);
+    }
+}
+
+void profiler::record_transfer(device_impl const *dev, transfer_direction direction, size_t bytes, cl_event event)
+{
+    if (dev->is_profiling())
+    {
+        add(new record{std::string{}, true, direction, bytes}, event);
+    }
+}
+
+std::map<std::string, profile_stats> profiler::get_kernel_stats()
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    wait_pending(lock);
+    return kernel_stats_;
+}
+
+profile_stats profiler::get_transfer_stats(transfer_direction direction)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    wait_pending(lock);
+    return transfer_stats_[direction];
+}
+
+void profiler::reset()
+{
+    logger("reset()");
+    std::unique_lock<std::mutex> lock{mutex_};
+    wait_pending(lock);
+    kernel_stats_.clear();
+    transfer_stats_.clear();
+}
+
+void profiler::dump(std::ostream &out)
+{
+    std::unique_lock<std::mutex> lock{mutex_};
+    wait_pending(lock);
+    for (auto const &entry : kernel_stats_)
+    {
+        __print_stats(out, entry.first, entry.second);
+    }
+    for (auto const &entry : transfer_stats_)
+    {
+        __print_stats(out, entry.first == transfer_direction::UPLOAD ? "<upload>" : "<download>", entry.second);
+    }
+}
+} // namespace opencle
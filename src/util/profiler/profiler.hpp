@@ -0,0 +1,87 @@
+#pragma once
+
+#include <CL/cl.h>
+#include <array>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#include "../core_def.hpp"
+
+namespace opencle
+{
+class profiler;
+class device_impl;
+
+enum class transfer_direction
+{
+    UPLOAD,
+    DOWNLOAD
+};
+
+/** Timings accumulated over the commands of one kernel or one direction of
+ * transfers, all times in seconds. */
+struct profile_stats
+{
+    // bucket i counts commands running [2^(i-1), 2^i) microseconds, bucket 0 under 1us
+    static constexpr size_t histogram_bucket_num = 32;
+
+    size_t count = 0;
+    size_t bytes = 0;
+    // QUEUED to SUBMIT, time spent in the host side queue
+    double queue_time = 0;
+    // SUBMIT to START, time waiting for the device
+    double submit_time = 0;
+    // START to END
+    double exec_time = 0;
+    double max_exec_time = 0;
+    std::array<size_t, histogram_bucket_num> histogram{};
+
+    double get_mean_exec_time() const;
+    // bytes per second of execution, 0 for kernels
+    double get_bandwidth() const;
+};
+
+/** Collects the QUEUED/SUBMIT/START/END timestamps of commands enqueued on
+ * devices created with device_option::profiling. A command is recorded
+ * when its event completes, so recording does not block the caller;
+ * reading the statistics waits for the commands recorded so far. */
+class profiler final
+{
+private:
+    struct record
+    {
+        std::string name;
+        bool is_transfer;
+        transfer_direction direction;
+        size_t bytes;
+    };
+
+    static std::mutex mutex_;
+    static std::condition_variable pending_cv_;
+    static size_t pending_num_;
+    static std::map<std::string, profile_stats> kernel_stats_;
+    static std::map<transfer_direction, profile_stats> transfer_stats_;
+
+    static void on_complete(cl_event event, cl_int status, void *user_data);
+    static void add(record *rec, cl_event event);
+    static void wait_pending(std::unique_lock<std::mutex> &lock);
+
+public:
+    profiler() = delete;
+
+    /** No-op unless 'dev' has profiling enabled. 'event' is retained by
+     * OpenCL until the callback runs, the caller may release it. */
+    static void record_kernel(device_impl const *dev, std::string const &name, cl_event event);
+    static void record_transfer(device_impl const *dev, transfer_direction direction, size_t bytes, cl_event event);
+
+    static std::map<std::string, profile_stats> get_kernel_stats();
+    static profile_stats get_transfer_stats(transfer_direction direction);
+    static void reset();
+
+    /** Human readable summary of every kernel and transfer direction. */
+    static void dump(std::ostream &out);
+};
+} // namespace opencle
@@ -1,6 +1,243 @@
-#include <queue>
+#pragma once
 
-namespace opencle {
-template<typename T>
-using queue = std::queue<T>;
-}
\ No newline at end of file
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+#include "../core_def.hpp"
+
+namespace opencle
+{
+template <typename T>
+class queue;
+
+/** Bounded multi-producer multi-consumer queue (D. Vyukov's array queue).
+ * Every cell carries a sequence number telling whether it is free for the
+ * producer of a position or full for its consumer, so producers and
+ * consumers only race on their own position counter with one CAS and
+ * never take a lock. Cells and counters sit on their own cache lines.
+ * try_push / try_pop never block; push / pop spin briefly and then sleep
+ * on a condition variable, which the other side only touches when someone
+ * is actually waiting. T needs to be default constructible. */
+template <typename T>
+class queue final
+{
+public:
+    static constexpr size_t cache_line_size = 64;
+
+    // failed attempts of push / pop before they sleep
+    static constexpr size_t spin_num = 64;
+
+private:
+    struct alignas(cache_line_size) cell
+    {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    size_t mask_;
+    std::unique_ptr<cell[]> cells_;
+
+    alignas(cache_line_size) std::atomic<size_t> enqueue_pos_;
+    alignas(cache_line_size) std::atomic<size_t> dequeue_pos_;
+
+    // sleepers of push / pop, checked after every operation
+    alignas(cache_line_size) std::atomic<size_t> push_waiting_;
+    std::mutex push_mutex_;
+    std::condition_variable not_full_;
+
+    alignas(cache_line_size) std::atomic<size_t> pop_waiting_;
+    std::mutex pop_mutex_;
+    std::condition_variable not_empty_;
+
+    static size_t round_up(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size = size << 1;
+        }
+        return size;
+    }
+
+    // a sleeper counts itself before it checks the cell, and the other side
+    // checks the count after it changed the cell, so one of them sees the
+    // other; notifying under the mutex keeps the check and the sleep atomic
+    static void wake(std::atomic<size_t> &waiting, std::mutex &mutex, std::condition_variable &cv)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock{mutex};
+            cv.notify_all();
+        }
+    }
+
+    static void sleep(std::atomic<size_t> &waiting, std::mutex &mutex, std::condition_variable &cv,
+                      std::function<bool()> const &is_ready)
+    {
+        std::unique_lock<std::mutex> lock{mutex};
+        waiting.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        cv.wait(lock, is_ready);
+        waiting.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // the next cell is free / full, another thread may still take it first
+    bool can_push() const
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos;
+    }
+
+    bool can_pop() const
+    {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        return cells_[pos & mask_].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    template <typename U>
+    bool emplace(U &&value)
+    {
+        size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells_[pos & mask_];
+            size_t sequence = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+            if (diff == 0)
+            {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                // the consumer of the previous round has not taken it yet
+                return false;
+            }
+            else
+            {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        c->value = std::forward<U>(value);
+        c->sequence.store(pos + 1, std::memory_order_release);
+        wake(pop_waiting_, pop_mutex_, not_empty_);
+        return true;
+    }
+
+public:
+    /** 'capacity' is rounded up to a power of 2. */
+    explicit queue(size_t capacity)
+        : mask_{round_up(capacity) - 1}, cells_{new cell[mask_ + 1]}, enqueue_pos_{0}, dequeue_pos_{0},
+          push_waiting_{0}, pop_waiting_{0}
+    {
+        for (size_t i = 0; i <= mask_; ++i)
+        {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    queue(queue const &rhs) = delete;
+    queue(queue &&rhs) = delete;
+    ~queue() = default;
+
+    queue &operator=(queue const &rhs) = delete;
+    queue &operator=(queue &&rhs) = delete;
+
+    /** Enqueue unless full, 'value' is left untouched on failure. */
+    bool try_push(T &&value)
+    {
+        return emplace(std::move(value));
+    }
+
+    bool try_push(T const &value)
+    {
+        return emplace(value);
+    }
+
+    /** Dequeue into 'value' unless empty. */
+    bool try_pop(T &value)
+    {
+        size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+        cell *c;
+        while (true)
+        {
+            c = &cells_[pos & mask_];
+            size_t sequence = c->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+            if (diff == 0)
+            {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                return false;
+            }
+            else
+            {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        value = std::move(c->value);
+        // resources held by the moved-from value go now, not a round later
+        c->value = T{};
+        c->sequence.store(pos + mask_ + 1, std::memory_order_release);
+        wake(push_waiting_, push_mutex_, not_full_);
+        return true;
+    }
+
+    /** Enqueue, waiting while the queue is full. */
+    void push(T value)
+    {
+        for (size_t i = 1; !try_push(std::move(value)); ++i)
+        {
+            if (i >= spin_num)
+            {
+                sleep(push_waiting_, push_mutex_, not_full_, [this] { return can_push(); });
+            }
+        }
+    }
+
+    /** Dequeue into 'value', waiting while the queue is empty. */
+    void pop(T &value)
+    {
+        for (size_t i = 1; !try_pop(value); ++i)
+        {
+            if (i >= spin_num)
+            {
+                sleep(pop_waiting_, pop_mutex_, not_empty_, [this] { return can_pop(); });
+            }
+        }
+    }
+
+    size_t capacity() const
+    {
+        return mask_ + 1;
+    }
+
+    /** Exact only while no one pushes or pops. */
+    size_t size() const
+    {
+        size_t enqueued = enqueue_pos_.load(std::memory_order_acquire);
+        size_t dequeued = dequeue_pos_.load(std::memory_order_acquire);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+};
+} // namespace opencle
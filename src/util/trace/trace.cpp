@@ -0,0 +1,200 @@
+#include "trace.hpp"
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <map>
+
+#include "../logger/logger.hpp"
+
+namespace opencle
+{
+std::atomic<bool> trace::is_enabled_ = false;
+std::mutex trace::buffers_mutex_ = std::mutex{};
+std::vector<std::shared_ptr<trace::thread_buffer>> trace::buffers_ = std::vector<std::shared_ptr<thread_buffer>>{};
+std::vector<std::shared_ptr<trace::thread_buffer>> trace::idle_buffers_ =
+    std::vector<std::shared_ptr<thread_buffer>>{};
+std::string trace::output_path_ = std::string{};
+std::set<std::string> trace::names_ = std::set<std::string>{};
+std::chrono::steady_clock::time_point trace::origin_ = std::chrono::steady_clock::now();
+
+trace::buffer_lease::~buffer_lease()
+{
+    // the spans stay in the registry, the next thread appends after them
+    std::lock_guard<std::mutex> lock{buffers_mutex_};
+    idle_buffers_.push_back(std::move(buffer));
+}
+
+trace::thread_buffer &trace::get_thread_buffer()
+{
+    // the registry shares the buffer, so spans outlive their thread
+    thread_local buffer_lease lease{[]() {
+        std::lock_guard<std::mutex> lock{buffers_mutex_};
+        if (!idle_buffers_.empty())
+        {
+            auto temp = std::move(idle_buffers_.back());
+            idle_buffers_.pop_back();
+            return temp;
+        }
+
+        auto temp = std::make_shared<thread_buffer>();
+        temp->size = 0;
+        temp->dropped = 0;
+        temp->spans = std::make_unique<span[]>(max_span_num);
+        temp->thread_index = buffers_.size();
+        buffers_.push_back(temp);
+        return temp;
+    }()};
+    return *lease.buffer;
+}
+
+void trace::enable(bool is_enabled)
+{
+    logger("enable(bool)");
+    is_enabled_ = is_enabled;
+}
+
+void trace::set_output(std::string const &path)
+{
+    logger("set_output(std::string const &)");
+    std::lock_guard<std::mutex> lock{buffers_mutex_};
+    if (output_path_.empty())
+    {
+        std::atexit(dump_at_exit);
+    }
+    output_path_ = path;
+    is_enabled_ = true;
+}
+
+void trace::dump_at_exit()
+{
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock{buffers_mutex_};
+        path = output_path_;
+    }
+    std::ofstream out{path, std::ios::trunc};
+    if (!out)
+    {
+        std::cerr << "[opencle] Cannot write trace to " << path << std::endl;
+        return;
+    }
+    write(out, false);
+}
+
+char const *trace::intern(std::string const &name)
+{
+    std::lock_guard<std::mutex> lock{buffers_mutex_};
+    return names_.insert(name).first->c_str();
+}
+
+int64_t trace::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin_).count();
+}
+
+void trace::record(char const *name, char const *category, void const *device, int64_t begin, int64_t end)
+{
+    thread_buffer &buffer = get_thread_buffer();
+    // only the owning thread writes, the release store publishes the span
+    size_t index = buffer.size.load(std::memory_order_relaxed);
+    if (index == max_span_num)
+    {
+        buffer.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    buffer.spans[index] = span{name, category, device, begin, end};
+    buffer.size.store(index + 1, std::memory_order_release);
+}
+
+void trace::dump(std::ostream &out)
+{
+    logger("dump(std::ostream &)");
+    write(out, true);
+}
+
+void trace::write(std::ostream &out, bool is_logged)
+{
+    std::vector<std::shared_ptr<thread_buffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock{buffers_mutex_};
+        buffers = buffers_;
+    }
+
+    // host spans are process 0, the spans of each device form their own process
+    std::map<void const *, size_t> device_pids;
+    bool is_first = true;
+    out << "{\"traceEvents\":[";
+    for (auto &buffer : buffers)
+    {
+        size_t size = buffer->size.load(std::memory_order_acquire);
+        for (size_t i = 0; i < size; ++i)
+        {
+            span const &s = buffer->spans[i];
+            size_t pid = 0;
+            if (s.device)
+            {
+                auto it = device_pids.emplace(s.device, device_pids.size() + 1).first;
+                pid = it->second;
+            }
+            out << (is_first ? "\n" : ",\n") << "{\"name\":\"" << s.name << "\",\"cat\":\"" << s.category
+                << "\",\"ph\":\"X\",\"ts\":" << s.begin << ",\"dur\":" << s.end - s.begin << ",\"pid\":" << pid
+                << ",\"tid\":" << buffer->thread_index << "}";
+            is_first = false;
+        }
+        if (buffer->dropped > 0 && is_logged)
+        {
+            logger_warn("Thread " << buffer->thread_index << " dropped " << buffer->dropped << " spans");
+        }
+        else if (buffer->dropped > 0)
+        {
+            std::cerr << "[opencle] Thread " << buffer->thread_index << " dropped " << buffer->dropped << " spans"
+                      << std::endl;
+        }
+    }
+
+    out << (is_first ? "\n" : ",\n") << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"host\"}}";
+    for (auto const &entry : device_pids)
+    {
+        out << ",\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << entry.second
+            << ",\"args\":{\"name\":\"device " << entry.first << "\"}}";
+    }
+    out << "\n]}\n";
+}
+
+void trace::dump(std::string const &path)
+{
+    std::ofstream out{path, std::ios::trunc};
+    if (!out)
+    {
+        logger_warn("Cannot write trace to " << path);
+        return;
+    }
+    dump(out);
+}
+
+void trace::clear()
+{
+    logger("clear()");
+    // only safe while no thread is recording
+    std::lock_guard<std::mutex> lock{buffers_mutex_};
+    for (auto &buffer : buffers_)
+    {
+        buffer->size = 0;
+        buffer->dropped = 0;
+    }
+}
+} // namespace opencle
+
+namespace
+{
+// defined after the registry, so the dump at exit runs before it is destroyed
+bool const __is_trace_output_set = []() {
+    char const *path = std::getenv("OPENCLE_TRACE");
+    if (path && *path)
+    {
+        opencle::trace::set_output(path);
+    }
+    return path != nullptr;
+}();
+} // namespace
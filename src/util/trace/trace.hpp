@@ -0,0 +1,131 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "../core_def.hpp"
+
+namespace opencle
+{
+class trace;
+class trace_span;
+
+/** Timeline of host side spans, dumped as Chrome Trace Event JSON, which
+ * chrome://tracing and ui.perfetto.dev both load. Every thread appends to
+ * its own fixed size buffer without locking; a full buffer drops new spans.
+ * The buffer of a thread that exits, spans and all, goes to the next thread
+ * starting to trace, so there are only as many as threads tracing at once.
+ * Tracing is off unless enabled, or $OPENCLE_TRACE names the file the trace
+ * is written to at exit. */
+class trace final
+{
+public:
+    // spans kept per thread, about 3MB of buffer for each tracing thread
+    static constexpr size_t max_span_num = 1 << 16;
+
+    struct span
+    {
+        // names and categories are string literals, only the pointer is kept
+        char const *name;
+        char const *category;
+        void const *device;
+        int64_t begin;
+        int64_t end;
+    };
+
+private:
+    struct thread_buffer
+    {
+        size_t thread_index;
+        std::atomic<size_t> size;
+        std::atomic<size_t> dropped;
+        std::unique_ptr<span[]> spans;
+    };
+
+    // hands the buffer of the thread back when the thread exits
+    struct buffer_lease
+    {
+        std::shared_ptr<thread_buffer> buffer;
+        ~buffer_lease();
+    };
+
+    static std::atomic<bool> is_enabled_;
+    static std::mutex buffers_mutex_;
+    static std::vector<std::shared_ptr<thread_buffer>> buffers_;
+    static std::vector<std::shared_ptr<thread_buffer>> idle_buffers_;
+    static std::string output_path_;
+    static std::set<std::string> names_;
+    static std::chrono::steady_clock::time_point origin_;
+
+    static thread_buffer &get_thread_buffer();
+
+    // the exit handler may run after the logger is gone, so it reports
+    // dropped spans and errors to std::cerr instead ('is_logged' false)
+    static void dump_at_exit();
+    static void write(std::ostream &out, bool is_logged);
+
+public:
+    trace() = delete;
+
+    static void enable(bool is_enabled = true);
+    static bool is_enabled()
+    {
+        return is_enabled_.load(std::memory_order_relaxed);
+    }
+
+    /** Write the trace to 'path' when the process exits, and enable it. */
+    static void set_output(std::string const &path);
+
+    /** Stable copy of a runtime name, e.g. a kernel name, for spans that
+     * may be dumped after its owner is gone, kept until exit. */
+    static char const *intern(std::string const &name);
+
+    /** Microseconds since the tracing origin. */
+    static int64_t now();
+    static void record(char const *name, char const *category, void const *device, int64_t begin, int64_t end);
+
+    /** Spans recorded so far. A thread still recording may have its newest
+     * spans missing from the dump. */
+    static void dump(std::ostream &out);
+    static void dump(std::string const &path);
+    static void clear();
+};
+
+/** RAII span from construction to destruction, 'device' groups spans of the
+ * same device_impl in the dump. Costs one relaxed load when tracing is off. */
+class trace_span final
+{
+private:
+    char const *name_;
+    char const *category_;
+    void const *device_;
+    int64_t begin_;
+
+public:
+    trace_span(char const *name, char const *category, void const *device = nullptr)
+        : name_{name}, category_{category}, device_{device}, begin_{trace::is_enabled() ? trace::now() : -1}
+    {
+    }
+
+    trace_span(trace_span const &rhs) = delete;
+    trace_span(trace_span &&rhs) = delete;
+
+    ~trace_span()
+    {
+        if (begin_ >= 0)
+        {
+            trace::record(name_, category_, device_, begin_, trace::now());
+        }
+    }
+
+    trace_span &operator=(trace_span const &rhs) = delete;
+    trace_span &operator=(trace_span &&rhs) = delete;
+};
+} // namespace opencle